@@ -0,0 +1,558 @@
+/*
+ * FBPAD BENCHMARKS
+ *
+ * This program replays synthetic terminal output streams through
+ * term.c and pad.c, drawing into an in-memory framebuffer that
+ * replaces draw.c, and reports the throughput of each stream.
+ * With -r, it replays a capture log of fbpad -r instead; with -s,
+ * it replays the log at its original speed and reports the time
+ * spent drawing.
+ *
+ * usage: fbbench [-f font.tf] [-m megabytes] [-r log [-s]]
+ */
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+#include "conf.h"
+#include "draw.h"
+#include "fbpad.h"
+
+#define CHUNK		4096	/* the number of bytes parsed for each frame */
+#define NLOGTERMS	256	/* the maximum number of terminals in capture logs */
+
+/* in-memory framebuffer */
+
+static char *fbmem;
+static int fbrows, fbcols, fbbpp;
+
+int fb_init(char *dev)
+{
+	fbmem = calloc(fbrows * fbcols, fbbpp);
+	return !fbmem;
+}
+
+void fb_free(void)
+{
+	free(fbmem);
+	fbmem = NULL;
+}
+
+unsigned fb_mode(void)
+{
+	return (fbbpp << 16) | (fbbpp == 2 ? 0x565 : 0x888);
+}
+
+void *fb_mem(int r)
+{
+	return fbmem + r * fbcols * fbbpp;
+}
+
+int fb_rows(void)
+{
+	return fbrows;
+}
+
+int fb_cols(void)
+{
+	return fbcols;
+}
+
+char *fb_dev(void)
+{
+	return "/dev/null";
+}
+
+void fb_cmap(void)
+{
+}
+
+void fb_release(void)
+{
+}
+
+unsigned fb_val(int r, int g, int b)
+{
+	if (fbbpp == 2)
+		return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+	return (r << 16) | (g << 8) | b;
+}
+
+void fb_copy(int dr, int sr, int n, int c, int w)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		int r = dr > sr ? n - i - 1 : i;
+		memmove((char *) fb_mem(dr + r) + c * fbbpp,
+			(char *) fb_mem(sr + r) + c * fbbpp, w * fbbpp);
+	}
+}
+
+int fb_backbuf(void)
+{
+	return 0;
+}
+
+void fb_damage(int r, int c, int n)
+{
+}
+
+void fb_flush(void)
+{
+}
+
+void fb_sync(void)
+{
+}
+
+/* synthetic terminal output streams */
+
+struct sbuf {
+	char *s;
+	int len, sz;
+};
+
+static void sb_put(struct sbuf *sb, char *s, int n)
+{
+	if (sb->len + n > sb->sz) {
+		sb->sz = MAX(sb->sz * 2, sb->len + n + 1024);
+		sb->s = realloc(sb->s, sb->sz);
+	}
+	memcpy(sb->s + sb->len, s, n);
+	sb->len += n;
+}
+
+static void sb_printf(struct sbuf *sb, char *fmt, ...)
+{
+	char buf[1024];
+	va_list ap;
+	va_start(ap, fmt);
+	sb_put(sb, buf, vsnprintf(buf, sizeof(buf), fmt, ap));
+	va_end(ap);
+}
+
+static void sb_utf8(struct sbuf *sb, int c)
+{
+	char b[4];
+	if (c < 0x800) {
+		b[0] = 0xc0 | (c >> 6);
+		b[1] = 0x80 | (c & 0x3f);
+		sb_put(sb, b, 2);
+	} else {
+		b[0] = 0xe0 | (c >> 12);
+		b[1] = 0x80 | ((c >> 6) & 0x3f);
+		b[2] = 0x80 | (c & 0x3f);
+		sb_put(sb, b, 3);
+	}
+}
+
+static unsigned rnd = 1;
+
+static int rand_n(int n)
+{
+	rnd = rnd * 1103515245 + 12345;
+	return (rnd >> 16) % n;
+}
+
+static char *words[] = {
+	"fbpad", "term.c", "pad.c", "Makefile", "README", "conf.h", "docs",
+	"font.tf", "isdw.c", "src", "scrsnap.c", "draw.c", "x.sh", "tags",
+};
+
+/* ls --color */
+static void gen_ls(struct sbuf *sb, int len)
+{
+	static char *clrs[] = {"0", "01;34", "01;32", "01;36", "00;31"};
+	while (sb->len < len) {
+		int i, n = 1 + rand_n(6);
+		for (i = 0; i < n; i++)
+			sb_printf(sb, "\x1b[%sm%s\x1b[0m  ", clrs[rand_n(LEN(clrs))],
+				words[rand_n(LEN(words))]);
+		sb_put(sb, "\r\n", 2);
+	}
+}
+
+/* seq */
+static void gen_seq(struct sbuf *sb, int len)
+{
+	int i;
+	for (i = 1; sb->len < len; i++)
+		sb_printf(sb, "%d\n", i);
+}
+
+/* CJK text mixed with ASCII, wrapping at the right margin */
+static void gen_cjk(struct sbuf *sb, int len)
+{
+	while (sb->len < len) {
+		int i, n = 10 + rand_n(120);
+		for (i = 0; i < n; i++)
+			if (rand_n(4))
+				sb_utf8(sb, 0x4e00 + rand_n(0x100));
+			else
+				sb_put(sb, words[rand_n(LEN(words))], 3);
+		sb_put(sb, "\r\n", 2);
+	}
+}
+
+/* 256-color art of half blocks */
+static void gen_c256(struct sbuf *sb, int len)
+{
+	while (sb->len < len) {
+		int i;
+		for (i = 0; i < 80; i++) {
+			sb_printf(sb, "\x1b[38;5;%dm\x1b[48;5;%dm", rand_n(256), rand_n(256));
+			sb_utf8(sb, 0x2580 + rand_n(32));
+		}
+		sb_put(sb, "\x1b[0m\r\n", 6);
+	}
+}
+
+/* scrolling a file in vim: scroll the region, draw the new line and the status line */
+static void gen_vim(struct sbuf *sb, int len, int rows)
+{
+	int ln;
+	sb_printf(sb, "\x1b[H\x1b[2J\x1b[1;%dr", rows - 1);
+	for (ln = 1; sb->len < len; ln++) {
+		int i, n = rand_n(8);
+		sb_printf(sb, "\x1b[?25l\x1b[%d;1H\n\x1b[33m%5d \x1b[0m", rows - 1, ln);
+		for (i = 0; i < n; i++)
+			sb_printf(sb, "\x1b[%dm%s\x1b[0m ", 31 + rand_n(7),
+				words[rand_n(LEN(words))]);
+		sb_printf(sb, "\x1b[%d;1H\x1b[7mtest.c  line %d\x1b[K\x1b[0m", rows, ln);
+		sb_printf(sb, "\x1b[%d;7H\x1b[?25h", rows - 1);
+	}
+}
+
+/* the length of the prefix of s, not longer than n, ending at a newline */
+static int chunklen(char *s, int n)
+{
+	int i = n;
+	while (i > 0 && s[i - 1] != '\n')
+		i--;
+	return i ? i : n;
+}
+
+/* capture logs of fbpad -r */
+
+static int loadlog(struct sbuf *sb, char *path)
+{
+	char buf[1 << 16];
+	int fd, n;
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 1;
+	memset(sb, 0, sizeof(*sb));
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		sb_put(sb, buf, n);
+	close(fd);
+	if (sb->len < strlen(CAPMAGIC) || memcmp(sb->s, CAPMAGIC, strlen(CAPMAGIC))) {
+		free(sb->s);
+		return 1;
+	}
+	return 0;
+}
+
+/* timing */
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long cycles(void)
+{
+#ifdef __x86_64__
+	return __rdtsc();
+#else
+	return now() * 1e9;
+#endif
+}
+
+/* tinyfont with random glyphs of ASCII, CJK and block characters */
+static int mkfont(char *path)
+{
+	int ranges[][2] = {{0x20, 0x7f}, {0x2580, 0x25a0}, {0x4e00, 0x4f00}};
+	int hdr[4] = {0, 0, 16, 8};
+	char bmp[16 * 8];
+	int fd, i, j, c;
+	if ((fd = mkstemp(path)) < 0)
+		return 1;
+	for (i = 0; i < LEN(ranges); i++)
+		hdr[1] += ranges[i][1] - ranges[i][0];
+	write(fd, "tinyfont", 8);
+	write(fd, hdr, sizeof(hdr));
+	for (i = 0; i < LEN(ranges); i++)
+		for (c = ranges[i][0]; c < ranges[i][1]; c++)
+			write(fd, &c, sizeof(c));
+	for (i = 0; i < hdr[1]; i++) {
+		for (j = 0; j < sizeof(bmp); j++)
+			bmp[j] = rand_n(3) ? 0 : rand_n(2) ? 255 : rand_n(256);
+		write(fd, bmp, sizeof(bmp));
+	}
+	close(fd);
+	return 0;
+}
+
+static struct mode {
+	int rows, cols, bpp;
+} modes[] = {
+	{768, 1024, 2},
+	{1080, 1920, 2},
+	{1080, 1920, 4},
+	{2160, 3840, 4},
+};
+
+static char *names[] = {"ls", "seq", "cjk", "c256", "vim"};
+
+/*
+ * Replaying capture logs: the records of each terminal are joined and
+ * the bytes read in each frame are parsed at its end, continuing into
+ * the next frame if a sequence is split, like term_read() would.
+ */
+
+static struct term *lterms[NLOGTERMS];
+static struct sbuf lout[NLOGTERMS];	/* the output of each terminal */
+static int lfed[NLOGTERMS];		/* the number of bytes parsed */
+static int lend[NLOGTERMS];		/* the number of bytes read so far */
+
+/* the offset of the payload of the record at k and its header in hdr, or -1 */
+static int logrec(struct sbuf *sb, int k, int *hdr)
+{
+	if (k + 3 * sizeof(hdr[0]) > sb->len)
+		return -1;
+	memcpy(hdr, sb->s + k, 3 * sizeof(hdr[0]));
+	k += 3 * sizeof(hdr[0]);
+	return hdr[2] >= 0 && hdr[2] <= sb->len - k ? k : -1;
+}
+
+static void replay_feed(int id, int visible)
+{
+	term_load(lterms[id], visible);
+	if (lfed[id] < lend[id])
+		lfed[id] += term_feed(lout[id].s + lfed[id],
+			lend[id] - lfed[id], lout[id].len - lfed[id]);
+}
+
+/* parse the bytes read in a frame and draw the terminal shown */
+static void replay_frame(int shown)
+{
+	int i;
+	for (i = 0; i < NLOGTERMS; i++) {
+		if (i != shown && lfed[i] < lend[i]) {
+			replay_feed(i, 0);
+			term_save(lterms[i]);
+		}
+	}
+	replay_feed(shown, 1);
+	term_flush();
+	fb_flush();
+	term_save(lterms[shown]);
+}
+
+/* replay the records of a capture log; the terminal of the first one is visible */
+static int replay(struct sbuf *sb, int speed, double *busy, unsigned long long *cyc)
+{
+	char *cat[] = {"cat", NULL};
+	static int warned;
+	int frames = 0, shown = -1, drop = 0;
+	int hdr[3], i, k, o;
+	long fms = 0;		/* the end of the current frame in log time */
+	double t0, idle = 0, t;
+	unsigned long long c0, cidle = 0, c;
+	memset(lout, 0, sizeof(lout));
+	memset(lfed, 0, sizeof(lfed));
+	memset(lend, 0, sizeof(lend));
+	for (k = strlen(CAPMAGIC); (o = logrec(sb, k, hdr)) >= 0; k = o + hdr[2]) {
+		if (hdr[1] == CAPDROP && hdr[2] == sizeof(int))
+			drop += *(int *) (sb->s + o);
+		if (hdr[1] < 0 || hdr[1] >= NLOGTERMS)
+			continue;
+		if (!lterms[hdr[1]]) {
+			lterms[hdr[1]] = term_make();
+			term_load(lterms[hdr[1]], 0);
+			term_exec(cat, 0);
+			term_save(lterms[hdr[1]]);
+		}
+		if (shown < 0)
+			shown = hdr[1];
+		sb_put(&lout[hdr[1]], sb->s + o, hdr[2]);
+	}
+	if (drop && !warned++)
+		fprintf(stderr, "fbbench: %d bytes are missing from the log\n", drop);
+	t0 = now();
+	c0 = cycles();
+	for (k = strlen(CAPMAGIC); (o = logrec(sb, k, hdr)) >= 0; k = o + hdr[2]) {
+		if (hdr[1] < 0 || hdr[1] >= NLOGTERMS)
+			continue;
+		if (hdr[0] >= fms) {
+			if (fms) {
+				replay_frame(shown);
+				frames++;
+			}
+			fms = hdr[0] + 1000 / FPS;
+		}
+		if (speed && hdr[0] / 1000.0 > now() - t0) {
+			c = cycles();
+			t = now();
+			usleep((hdr[0] / 1000.0 - (t - t0)) * 1e6);
+			idle += now() - t;
+			cidle += cycles() - c;
+		}
+		lend[hdr[1]] += hdr[2];
+	}
+	if (shown >= 0) {
+		replay_frame(shown);
+		frames++;
+	}
+	*busy = now() - t0 - idle;
+	*cyc = cycles() - c0 - cidle;
+	for (i = 0; i < NLOGTERMS; i++) {
+		if (lterms[i]) {
+			term_load(lterms[i], 0);
+			term_end();
+			term_free(lterms[i]);
+			lterms[i] = NULL;
+		}
+		free(lout[i].s);
+	}
+	return frames;
+}
+
+/* print the results of a stream; hits, misses and cells are the changes during it */
+static void report(char *name, long len, double t, int frames, unsigned long hits,
+		unsigned long misses, unsigned long cells, unsigned long long cyc)
+{
+	char gc[16] = "n/a";
+	if (GCSIZE)
+		snprintf(gc, sizeof(gc), "%.1f%%", 100.0 * hits / MAX(1, hits + misses));
+	printf("%4dx%-4d %2dbpp  %-6s %8.1f %8.0f %8s %9.1f\n",
+		fbcols, fbrows, fbbpp * 8, name, len / t / (1 << 20), frames / t,
+		gc, (double) cyc / MAX(1, cells));
+}
+
+static void bench_log(struct sbuf *sb, int speed)
+{
+	unsigned long h0, m0, e0, h1, m1, e1;
+	unsigned long n0 = pad_cells();
+	unsigned long long c;
+	double t;
+	int frames;
+	pad_gcstat(&h0, &m0, &e0);
+	frames = replay(sb, speed, &t, &c);
+	pad_gcstat(&h1, &m1, &e1);
+	report("log", sb->len, t, frames, h1 - h0, m1 - m0, pad_cells() - n0, c);
+}
+
+static void bench(char *font, int len, struct sbuf *caplog, int speed)
+{
+	char *cat[] = {"cat", NULL};
+	struct sbuf sb;
+	struct term *term;
+	int i, j, k;
+	printf("%-16s %-6s %8s %8s %8s %9s\n",
+		"mode", "stream", "MB/s", "frames/s", "gc hits", "cyc/cell");
+	for (i = 0; i < LEN(modes); i++) {
+		fbrows = modes[i].rows;
+		fbcols = modes[i].cols;
+		fbbpp = modes[i].bpp;
+		if (fb_init(NULL) || pad_init(font, NULL, NULL)) {
+			fprintf(stderr, "fbbench: cannot initialize the pad\n");
+			exit(1);
+		}
+		if (caplog) {
+			bench_log(caplog, speed);
+			pad_free();
+			fb_free();
+			continue;
+		}
+		term = term_make();
+		term_load(term, 1);
+		term_exec(cat, 0);
+		for (j = 0; j < LEN(names); j++) {
+			unsigned long h0, m0, e0, h1, m1, e1, n0;
+			unsigned long long c0;
+			double t0, t;
+			int frames = 0;
+			memset(&sb, 0, sizeof(sb));
+			rnd = j + 1;
+			if (j == 0)
+				gen_ls(&sb, len);
+			if (j == 1)
+				gen_seq(&sb, len);
+			if (j == 2)
+				gen_cjk(&sb, len);
+			if (j == 3)
+				gen_c256(&sb, len);
+			if (j == 4)
+				gen_vim(&sb, len, pad_rows());
+			term_feed("\x1b" "c", 2, 2);
+			term_flush();
+			pad_gcstat(&h0, &m0, &e0);
+			n0 = pad_cells();
+			t0 = now();
+			c0 = cycles();
+			for (k = 0; k < sb.len; frames++) {
+				int n = chunklen(sb.s + k, MIN(CHUNK, sb.len - k));
+				k += term_feed(sb.s + k, n, sb.len - k);
+				term_flush();
+				fb_flush();
+			}
+			t = now() - t0;
+			pad_gcstat(&h1, &m1, &e1);
+			report(names[j], sb.len, t, frames, h1 - h0, m1 - m0,
+				pad_cells() - n0, cycles() - c0);
+			free(sb.s);
+		}
+		term_end();
+		term_free(term);
+		pad_free();
+		fb_free();
+	}
+	pool_done();
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "/tmp/fbpad-bench-XXXXXX";
+	char *font = NULL;
+	char *logpath = NULL;
+	struct sbuf caplog;
+	int len = 2 << 20;
+	int speed = 0;
+	int i;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp("-f", argv[i]) && i + 1 < argc)
+			font = argv[++i];
+		else if (!strcmp("-m", argv[i]) && i + 1 < argc)
+			len = atoi(argv[++i]) << 20;
+		else if (!strcmp("-r", argv[i]) && i + 1 < argc)
+			logpath = argv[++i];
+		else if (!strcmp("-s", argv[i]))
+			speed = 1;
+		else {
+			fprintf(stderr, "usage: %s [-f font.tf] [-m megabytes] [-r log [-s]]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (logpath && loadlog(&caplog, logpath)) {
+		fprintf(stderr, "fbbench: cannot read the capture log\n");
+		return 1;
+	}
+	if (!font && mkfont(path)) {
+		fprintf(stderr, "fbbench: cannot create the font\n");
+		return 1;
+	}
+	bench(font ? font : path, len, logpath ? &caplog : NULL, speed);
+	if (!font)
+		unlink(path);
+	if (logpath)
+		free(caplog.s);
+	return 0;
+}
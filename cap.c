@@ -0,0 +1,169 @@
+/*
+ * Capturing the output of terminals
+ *
+ * Capture logs start with CAPMAGIC, followed by records of three ints:
+ * the milliseconds since the start of the capture, the terminal, and
+ * n, followed by the n bytes read from the terminal.  The records are
+ * buffered and written to a socket once in each iteration of the main
+ * loop; a child process writes them to the log, so that fbpad does not
+ * wait for the disk.  If the writer falls behind and the buffer is full,
+ * the output is dropped; a record of terminal CAPDROP, whose bytes are an
+ * int, then tells how many bytes were dropped before it.  fbbench -r
+ * replays capture logs.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "fbpad.h"
+
+#define CAPBUF		(1 << 20)	/* the size of the capture buffer */
+
+static char capbuf[CAPBUF];
+static int caplen;
+static int capfd = -1;		/* the socket to the writer */
+static int cappid;		/* the writer process */
+static long capms;		/* the start of the capture */
+static int capdrop;		/* the number of bytes dropped */
+
+static long cap_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* copy the socket to fd until EOF */
+static void cap_writer(int pfd, int fd)
+{
+	int n;
+	while ((n = read(pfd, capbuf, sizeof(capbuf))) != 0) {
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 || write(fd, capbuf, n) != n)
+			break;
+	}
+	_exit(0);
+}
+
+/* start capturing to path */
+int cap_open(char *path)
+{
+	int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0600);
+	int pfd[2];
+	int n = CAPBUF;
+	if (fd < 0 || write(fd, CAPMAGIC, strlen(CAPMAGIC)) < 0 ||
+			socketpair(AF_UNIX, SOCK_STREAM, 0, pfd)) {
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+	if ((cappid = fork()) < 0) {
+		close(pfd[0]);
+		close(pfd[1]);
+		close(fd);
+		return 1;
+	}
+	if (!cappid) {
+		close(pfd[1]);
+		cap_writer(pfd[0], fd);
+	}
+	close(pfd[0]);
+	close(fd);
+	capfd = pfd[1];
+	fcntl(capfd, F_SETFD, FD_CLOEXEC);
+	fcntl(capfd, F_SETFL, O_NONBLOCK);
+	setsockopt(capfd, SOL_SOCKET, SO_SNDBUF, &n, sizeof(n));
+	capms = cap_ms();
+	return 0;
+}
+
+/* stop capturing without writing; fbpad's child processes call it */
+void cap_forget(void)
+{
+	if (capfd >= 0)
+		close(capfd);
+	capfd = -1;
+	caplen = 0;
+	capdrop = 0;
+}
+
+/* write the buffered records; if wait is nonzero, all of them */
+static void cap_write(int wait)
+{
+	struct pollfd ufds[1];
+	int off = 0;
+	while (off < caplen) {
+		int n = send(capfd, capbuf + off, caplen - off, MSG_NOSIGNAL);
+		if (n > 0) {
+			off += n;
+			continue;
+		}
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {	/* the writer died */
+			cap_forget();
+			return;
+		}
+		if (!wait)
+			break;
+		ufds[0].fd = capfd;
+		ufds[0].events = POLLOUT;
+		poll(ufds, 1, 1000);
+	}
+	memmove(capbuf, capbuf + off, caplen - off);
+	caplen -= off;
+}
+
+static void cap_rec(int id, char *s, int n)
+{
+	int hdr[3];
+	hdr[0] = cap_ms() - capms;
+	hdr[1] = id;
+	hdr[2] = n;
+	memcpy(capbuf + caplen, hdr, sizeof(hdr));
+	memcpy(capbuf + caplen + sizeof(hdr), s, n);
+	caplen += sizeof(hdr) + n;
+}
+
+/* record n bytes read from terminal id; drop them if the buffer is full */
+void cap_put(int id, char *s, int n)
+{
+	int need = 3 * sizeof(int) + n + (capdrop ? 4 * sizeof(int) : 0);
+	if (capfd < 0)
+		return;
+	if (caplen + need > CAPBUF)
+		cap_write(0);
+	if (caplen + need > CAPBUF) {
+		capdrop += n;
+		return;
+	}
+	if (capdrop)
+		cap_rec(CAPDROP, (void *) &capdrop, sizeof(capdrop));
+	capdrop = 0;
+	cap_rec(id, s, n);
+}
+
+/* write the buffered records to the writer, without waiting for it */
+void cap_flush(void)
+{
+	if (capfd >= 0 && caplen)
+		cap_write(0);
+}
+
+/* write the remaining records and wait for the writer */
+void cap_close(void)
+{
+	if (capfd >= 0)
+		cap_write(1);
+	if (capfd >= 0 && capdrop) {
+		cap_rec(CAPDROP, (void *) &capdrop, sizeof(capdrop));
+		cap_write(1);
+	}
+	cap_forget();
+	if (cappid > 0)
+		waitpid(cappid, NULL, 0);
+	cappid = 0;
+}
@@ -20,6 +20,11 @@
  * e.g. if "/tmp/scr" then file will be "/tmp/scr-name" */
 #define SCRSHOT		"/tmp/scr"
 
+/* write screenshots with colours and attributes as ANSI escape sequences,
+ * and pipe them to this command, unless NULL, like {"gzip", NULL} */
+#define SCRANSI		0
+#define SCRZIP		{NULL}
+
 /* file from which to read terminal font and colour options */
 #define CLRFILE		"/tmp/clr"
 
@@ -27,6 +32,27 @@
  * this should be the port it uses */
 #define SSHPORT		22
 
+/* the number of scrolling history lines of each terminal; they are
+ * allocated as needed and FBPAD_HIST environment variable overrides it */
+#define NHIST		1024
+
+/* the number of rendered glyphs to cache; if zero, glyphs are blended
+ * into the framebuffer from font bitmaps, without using more memory */
+#define GCSIZE		2048
+
+/* the maximum number of screen updates per second */
+#define FPS		60
+
+/* the number of bytes read from each of the other terminals in one
+ * iteration of the main loop, so that noisy ones cannot delay the current one */
+#define BGREAD		8192
+
+/* collect hot path statistics; shown with m-g and saved with m-^g */
+#define STATS		0
+
+/* draw in a back buffer and copy only its changes to the framebuffer */
+#define BACKBUF		1
+
 /* optimized version of fb_val() */
 #define FB_VAL(r, g, b)	fb_val((r), (g), (b))
 
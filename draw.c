@@ -12,34 +12,49 @@
 #define MAX(a, b)	((a) > (b) ? (a) : (b))
 #define NLEVELS		(1 << 8)
 
-static struct fb_var_screeninfo vinfo;	/* linux-specific FB structure */
-static struct fb_fix_screeninfo finfo;	/* linux-specific FB structure */
-static char fbdev[1024];		/* FB device */
-static int fd;				/* FB device file descriptor */
-static void *fb;			/* mmap()ed FB memory */
-static int bpp;				/* bytes per pixel */
-static int nr, ng, nb;			/* color levels */
-static int rl, rr, gl, gr, bl, br;	/* shifts per color */
-static int xres, yres, xoff, yoff;	/* drawing region */
+/* the state of a framebuffer device */
+struct fbdev {
+	struct fb_var_screeninfo vinfo;	/* linux-specific FB structure */
+	struct fb_fix_screeninfo finfo;	/* linux-specific FB structure */
+	char path[1024];		/* FB device */
+	int fd;				/* FB device file descriptor */
+	void *fb;			/* mmap()ed FB memory */
+	int bpp;			/* bytes per pixel */
+	int nr, ng, nb;			/* color levels */
+	int rl, rr, gl, gr, bl, br;	/* shifts per color */
+	int xres, yres, xoff, yoff;	/* drawing region */
+	char *bb;			/* back buffer, if any */
+	int *dsc, *dec;			/* damaged columns of back buffer rows */
+	int drs, dre;			/* damaged back buffer rows */
+};
+
+static struct fbdev fbdevs[NFBDEV];
+static struct fbdev *fbd = fbdevs;	/* the current device */
+
+/* select framebuffer i for the functions of this file */
+void fb_use(int i)
+{
+	fbd = &fbdevs[i];
+}
 
 static int fb_len(void)
 {
-	return finfo.line_length * vinfo.yres_virtual;
+	return fbd->finfo.line_length * fbd->vinfo.yres_virtual;
 }
 
 static void fb_cmap_save(int save)
 {
 	static unsigned short red[NLEVELS], green[NLEVELS], blue[NLEVELS];
 	struct fb_cmap cmap;
-	if (finfo.visual == FB_VISUAL_TRUECOLOR)
+	if (fbd->finfo.visual == FB_VISUAL_TRUECOLOR)
 		return;
 	cmap.start = 0;
-	cmap.len = MAX(nr, MAX(ng, nb));
+	cmap.len = MAX(fbd->nr, MAX(fbd->ng, fbd->nb));
 	cmap.red = red;
 	cmap.green = green;
 	cmap.blue = blue;
 	cmap.transp = NULL;
-	ioctl(fd, save ? FBIOGETCMAP : FBIOPUTCMAP, &cmap);
+	ioctl(fbd->fd, save ? FBIOGETCMAP : FBIOPUTCMAP, &cmap);
 }
 
 void fb_cmap(void)
@@ -47,44 +62,50 @@ void fb_cmap(void)
 	unsigned short red[NLEVELS], green[NLEVELS], blue[NLEVELS];
 	struct fb_cmap cmap;
 	int i;
-	if (finfo.visual == FB_VISUAL_TRUECOLOR)
+	if (fbd->finfo.visual == FB_VISUAL_TRUECOLOR)
 		return;
 
-	for (i = 0; i < nr; i++)
-		red[i] = (65535 / (nr - 1)) * i;
-	for (i = 0; i < ng; i++)
-		green[i] = (65535 / (ng - 1)) * i;
-	for (i = 0; i < nb; i++)
-		blue[i] = (65535 / (nb - 1)) * i;
+	for (i = 0; i < fbd->nr; i++)
+		red[i] = (65535 / (fbd->nr - 1)) * i;
+	for (i = 0; i < fbd->ng; i++)
+		green[i] = (65535 / (fbd->ng - 1)) * i;
+	for (i = 0; i < fbd->nb; i++)
+		blue[i] = (65535 / (fbd->nb - 1)) * i;
 
 	cmap.start = 0;
-	cmap.len = MAX(nr, MAX(ng, nb));
+	cmap.len = MAX(fbd->nr, MAX(fbd->ng, fbd->nb));
 	cmap.red = red;
 	cmap.green = green;
 	cmap.blue = blue;
 	cmap.transp = NULL;
 
-	ioctl(fd, FBIOPUTCMAP, &cmap);
+	ioctl(fbd->fd, FBIOPUTCMAP, &cmap);
+}
+
+/* called when switching out of the virtual terminal */
+void fb_release(void)
+{
 }
 
 unsigned fb_mode(void)
 {
-	return ((rl < gl) << 22) | ((rl < bl) << 21) | ((gl < bl) << 20) |
-		(bpp << 16) | (vinfo.red.length << 8) |
-		(vinfo.green.length << 4) | (vinfo.blue.length);
+	struct fb_var_screeninfo *vi = &fbd->vinfo;
+	return ((fbd->rl < fbd->gl) << 22) | ((fbd->rl < fbd->bl) << 21) |
+		((fbd->gl < fbd->bl) << 20) | (fbd->bpp << 16) |
+		(vi->red.length << 8) | (vi->green.length << 4) | (vi->blue.length);
 }
 
 static void init_colors(void)
 {
-	nr = 1 << vinfo.red.length;
-	ng = 1 << vinfo.blue.length;
-	nb = 1 << vinfo.green.length;
-	rr = 8 - vinfo.red.length;
-	rl = vinfo.red.offset;
-	gr = 8 - vinfo.green.length;
-	gl = vinfo.green.offset;
-	br = 8 - vinfo.blue.length;
-	bl = vinfo.blue.offset;
+	fbd->nr = 1 << fbd->vinfo.red.length;
+	fbd->ng = 1 << fbd->vinfo.blue.length;
+	fbd->nb = 1 << fbd->vinfo.green.length;
+	fbd->rr = 8 - fbd->vinfo.red.length;
+	fbd->rl = fbd->vinfo.red.offset;
+	fbd->gr = 8 - fbd->vinfo.green.length;
+	fbd->gl = fbd->vinfo.green.offset;
+	fbd->br = 8 - fbd->vinfo.blue.length;
+	fbd->bl = fbd->vinfo.blue.offset;
 }
 
 int fb_init(char *dev)
@@ -93,20 +114,21 @@ int fb_init(char *dev)
 	char *geom = dev ? strchr(dev, ':') : NULL;
 	if (geom) {
 		*geom = '\0';
-		sscanf(geom + 1, "%dx%d%d%d", &xres, &yres, &xoff, &yoff);
+		sscanf(geom + 1, "%dx%d%d%d",
+			&fbd->xres, &fbd->yres, &fbd->xoff, &fbd->yoff);
 	}
-	snprintf(fbdev, sizeof(fbdev), "%s", path);
-	fd = open(path, O_RDWR);
-	if (fd < 0)
+	snprintf(fbd->path, sizeof(fbd->path), "%s", path);
+	fbd->fd = open(path, O_RDWR);
+	if (fbd->fd < 0)
 		goto failed;
-	if (ioctl(fd, FBIOGET_VSCREENINFO, &vinfo) < 0)
+	if (ioctl(fbd->fd, FBIOGET_VSCREENINFO, &fbd->vinfo) < 0)
 		goto failed;
-	if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) < 0)
+	if (ioctl(fbd->fd, FBIOGET_FSCREENINFO, &fbd->finfo) < 0)
 		goto failed;
-	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
-	bpp = (vinfo.bits_per_pixel + 7) >> 3;
-	fb = mmap(NULL, fb_len(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (fb == MAP_FAILED)
+	fcntl(fbd->fd, F_SETFD, fcntl(fbd->fd, F_GETFD) | FD_CLOEXEC);
+	fbd->bpp = (fbd->vinfo.bits_per_pixel + 7) >> 3;
+	fbd->fb = mmap(NULL, fb_len(), PROT_READ | PROT_WRITE, MAP_SHARED, fbd->fd, 0);
+	if (fbd->fb == MAP_FAILED)
 		goto failed;
 	init_colors();
 	fb_cmap_save(1);
@@ -114,38 +136,133 @@ int fb_init(char *dev)
 	return 0;
 failed:
 	perror("fb_init()");
-	close(fd);
+	close(fbd->fd);
 	return 1;
 }
 
 void fb_free(void)
 {
 	fb_cmap_save(0);
-	munmap(fb, fb_len());
-	close(fd);
+	free(fbd->bb);
+	free(fbd->dsc);
+	free(fbd->dec);
+	munmap(fbd->fb, fb_len());
+	close(fbd->fd);
+	memset(fbd, 0, sizeof(*fbd));
 }
 
 int fb_rows(void)
 {
-	return yres ? yres : vinfo.yres;
+	return fbd->yres ? fbd->yres : fbd->vinfo.yres;
 }
 
 int fb_cols(void)
 {
-	return xres ? xres : vinfo.xres;
+	return fbd->xres ? fbd->xres : fbd->vinfo.xres;
+}
+
+static char *fb_row(int r)
+{
+	return fbd->fb + (r + fbd->vinfo.yoffset + fbd->yoff) * fbd->finfo.line_length +
+		(fbd->vinfo.xoffset + fbd->xoff) * fbd->bpp;
 }
 
 void *fb_mem(int r)
 {
-	return fb + (r + vinfo.yoffset + yoff) * finfo.line_length + (vinfo.xoffset + xoff) * bpp;
+	return fbd->bb ? fbd->bb + r * fb_cols() * fbd->bpp : fb_row(r);
+}
+
+/* draw in an off-screen buffer; fb_flush() copies its changes to the framebuffer */
+int fb_backbuf(void)
+{
+	int i;
+	fbd->bb = malloc(fb_rows() * fb_cols() * fbd->bpp);
+	fbd->dsc = malloc(fb_rows() * sizeof(fbd->dsc[0]));
+	fbd->dec = malloc(fb_rows() * sizeof(fbd->dec[0]));
+	if (!fbd->bb || !fbd->dsc || !fbd->dec) {
+		free(fbd->bb);
+		free(fbd->dsc);
+		free(fbd->dec);
+		fbd->bb = NULL;
+		return 1;
+	}
+	for (i = 0; i < fb_rows(); i++) {
+		memcpy(fbd->bb + i * fb_cols() * fbd->bpp, fb_row(i), fb_cols() * fbd->bpp);
+		fbd->dsc[i] = fb_cols();
+		fbd->dec[i] = 0;
+	}
+	fbd->drs = fb_rows();
+	fbd->dre = 0;
+	return 0;
+}
+
+/* mark n pixels of row r, starting from column c, as changed */
+void fb_damage(int r, int c, int n)
+{
+	if (!fbd->bb || r < 0 || r >= fb_rows() || n <= 0)
+		return;
+	fbd->dsc[r] = MIN(fbd->dsc[r], MAX(0, c));
+	fbd->dec[r] = MAX(fbd->dec[r], MIN(fb_cols(), c + n));
+	fbd->drs = MIN(fbd->drs, r);
+	fbd->dre = MAX(fbd->dre, r + 1);
+}
+
+/* copy the changed regions of the back buffer to the framebuffer */
+void fb_flush(void)
+{
+	int rowsz = fb_cols() * fbd->bpp;
+	int *dsc = fbd->dsc, *dec = fbd->dec;
+	int bpp = fbd->bpp;
+	int i, j;
+	for (i = fbd->drs; i < fbd->dre; i = j) {
+		j = i + 1;
+		if (dsc[i] >= dec[i])
+			continue;
+		/* whole rows are contiguous in both buffers, if lines are not padded */
+		if (dsc[i] == 0 && dec[i] == fb_cols() && rowsz == fbd->finfo.line_length)
+			while (j < fbd->dre && dsc[j] == 0 && dec[j] == fb_cols())
+				j++;
+		memcpy(fb_row(i) + dsc[i] * bpp, fbd->bb + i * rowsz + dsc[i] * bpp,
+			(j - i - 1) * rowsz + (dec[i] - dsc[i]) * bpp);
+	}
+	for (i = fbd->drs; i < fbd->dre; i++) {
+		dsc[i] = fb_cols();
+		dec[i] = 0;
+	}
+	fbd->drs = fb_rows();
+	fbd->dre = 0;
+}
+
+/* copy n rows of w pixels from row sr to row dr, starting at column c */
+void fb_copy(int dr, int sr, int n, int c, int w)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		int r = dr > sr ? n - i - 1 : i;
+		memmove(fb_mem(dr + r) + c * fbd->bpp, fb_mem(sr + r) + c * fbd->bpp,
+			w * fbd->bpp);
+		fb_damage(dr + r, c, w);
+	}
+}
+
+/* update the back buffer from the framebuffer, to include other programs' changes */
+void fb_sync(void)
+{
+	int i;
+	if (!fbd->bb)
+		return;
+	fb_flush();
+	for (i = 0; i < fb_rows(); i++)
+		memcpy(fbd->bb + i * fb_cols() * fbd->bpp, fb_row(i), fb_cols() * fbd->bpp);
 }
 
 unsigned fb_val(int r, int g, int b)
 {
-	return ((r >> rr) << rl) | ((g >> gr) << gl) | ((b >> br) << bl);
+	return ((r >> fbd->rr) << fbd->rl) | ((g >> fbd->gr) << fbd->gl) |
+		((b >> fbd->br) << fbd->bl);
 }
 
 char *fb_dev(void)
 {
-	return fbdev;
+	return fbd->path;
 }
@@ -1,5 +1,6 @@
 /* fbpad's framebuffer interface */
 #define FBDEV		"/dev/fb0"
+#define NFBDEV		4		/* the maximum number of framebuffers */
 
 /* fb_mode() interpretation */
 #define FBM_BPP(m)	(((m) >> 16) & 0x0f)	/* bytes per pixel (4 bits) */
@@ -15,4 +16,13 @@ int fb_rows(void);
 int fb_cols(void);
 char *fb_dev(void);
 void fb_cmap(void);
+void fb_release(void);
 unsigned fb_val(int r, int g, int b);
+void fb_copy(int dr, int sr, int n, int c, int w);
+/* back buffer */
+int fb_backbuf(void);
+void fb_damage(int r, int c, int n);
+void fb_flush(void);
+void fb_sync(void);
+/* multiple framebuffers */
+void fb_use(int i);
@@ -0,0 +1,343 @@
+/*
+ * DRM/KMS implementation of draw.h
+ *
+ * Drawing goes to a back buffer in system memory.  fb_flush() copies
+ * its changes to one of two dumb buffers and presents it with
+ * drmModePageFlip() at the next vertical blank, so that frames are
+ * shown whole.  Link with -ldrm instead of draw.o.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "draw.h"
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+#define DRMDEV		"/dev/dri/card0"
+#define BPP		4		/* XRGB8888 */
+
+/* a dumb buffer */
+struct dbuf {
+	unsigned handle;	/* GEM handle */
+	unsigned id;		/* framebuffer id */
+	unsigned pitch;		/* bytes per line */
+	unsigned long size;
+	char *mem;		/* mmap()ed buffer */
+};
+
+/* the state of a DRM device */
+struct fbdev {
+	int fd;				/* DRM device file descriptor */
+	unsigned conn, crtc;		/* connector and CRTC ids */
+	drmModeModeInfo mode;		/* display mode */
+	drmModeCrtc *ocrtc;		/* the CRTC before fb_init() */
+	struct dbuf bufs[2];		/* dumb buffers */
+	int front;			/* the buffer on the screen */
+	int flipping;			/* a page flip is pending */
+	int xres, yres, xoff, yoff;	/* drawing region */
+	char *bb;			/* back buffer */
+	int *dsc, *dec;			/* damaged columns of back buffer rows */
+	int *psc, *pec;			/* the damage of the previous frame */
+	int drs, dre;			/* damaged back buffer rows */
+	int pdrs, pdre;			/* damaged rows of the previous frame */
+};
+
+static struct fbdev fbdevs[NFBDEV];
+static struct fbdev *fbd = fbdevs;	/* the current device */
+
+/* select framebuffer i for the functions of this file */
+void fb_use(int i)
+{
+	fbd = &fbdevs[i];
+}
+
+static int dbuf_make(struct dbuf *b, int w, int h)
+{
+	struct drm_mode_create_dumb creq = {.width = w, .height = h, .bpp = BPP * 8};
+	struct drm_mode_map_dumb mreq = {0};
+	if (drmIoctl(fbd->fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0)
+		return 1;
+	b->handle = creq.handle;
+	b->pitch = creq.pitch;
+	b->size = creq.size;
+	if (drmModeAddFB(fbd->fd, w, h, 24, BPP * 8, b->pitch, b->handle, &b->id))
+		return 1;
+	mreq.handle = b->handle;
+	if (drmIoctl(fbd->fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0)
+		return 1;
+	b->mem = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_SHARED, fbd->fd, mreq.offset);
+	if (b->mem == MAP_FAILED) {
+		b->mem = NULL;
+		return 1;
+	}
+	memset(b->mem, 0, b->size);
+	return 0;
+}
+
+static void dbuf_free(struct dbuf *b)
+{
+	struct drm_mode_destroy_dumb dreq = {.handle = b->handle};
+	if (b->mem)
+		munmap(b->mem, b->size);
+	if (b->id)
+		drmModeRmFB(fbd->fd, b->id);
+	if (b->handle)
+		drmIoctl(fbd->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+}
+
+/* find a connected connector, its preferred mode and a CRTC for it */
+static int drm_output(void)
+{
+	drmModeRes *res = drmModeGetResources(fbd->fd);
+	drmModeConnector *conn = NULL;
+	drmModeEncoder *enc;
+	int i, j, k;
+	if (!res)
+		return 1;
+	for (i = 0; i < res->count_connectors && !fbd->conn; i++) {
+		conn = drmModeGetConnector(fbd->fd, res->connectors[i]);
+		if (conn && conn->connection == DRM_MODE_CONNECTED && conn->count_modes) {
+			fbd->conn = conn->connector_id;
+			fbd->mode = conn->modes[0];
+			for (j = 0; j < conn->count_encoders && !fbd->crtc; j++) {
+				if (!(enc = drmModeGetEncoder(fbd->fd, conn->encoders[j])))
+					continue;
+				if (enc->encoder_id == conn->encoder_id && enc->crtc_id)
+					fbd->crtc = enc->crtc_id;
+				for (k = 0; k < res->count_crtcs && !fbd->crtc; k++)
+					if (enc->possible_crtcs & (1 << k))
+						fbd->crtc = res->crtcs[k];
+				drmModeFreeEncoder(enc);
+			}
+		}
+		drmModeFreeConnector(conn);
+	}
+	drmModeFreeResources(res);
+	return !fbd->conn || !fbd->crtc;
+}
+
+int fb_init(char *dev)
+{
+	char *path = dev ? dev : DRMDEV;
+	char *geom = dev ? strchr(dev, ':') : NULL;
+	int w, h;
+	if (geom) {
+		*geom = '\0';
+		sscanf(geom + 1, "%dx%d%d%d",
+			&fbd->xres, &fbd->yres, &fbd->xoff, &fbd->yoff);
+	}
+	fbd->fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fbd->fd < 0)
+		goto failed;
+	if (drm_output())
+		goto failed;
+	w = fbd->mode.hdisplay;
+	h = fbd->mode.vdisplay;
+	if (!fbd->xres || fbd->xoff + fbd->xres > w)
+		fbd->xres = w - fbd->xoff;
+	if (!fbd->yres || fbd->yoff + fbd->yres > h)
+		fbd->yres = h - fbd->yoff;
+	if (dbuf_make(&fbd->bufs[0], w, h) || dbuf_make(&fbd->bufs[1], w, h))
+		goto failed;
+	fbd->ocrtc = drmModeGetCrtc(fbd->fd, fbd->crtc);
+	if (drmModeSetCrtc(fbd->fd, fbd->crtc, fbd->bufs[0].id, 0, 0,
+			&fbd->conn, 1, &fbd->mode))
+		goto failed;
+	fbd->bb = calloc(fb_rows() * fb_cols(), BPP);
+	fbd->dsc = malloc(fb_rows() * sizeof(fbd->dsc[0]));
+	fbd->dec = calloc(fb_rows(), sizeof(fbd->dec[0]));
+	fbd->psc = malloc(fb_rows() * sizeof(fbd->psc[0]));
+	fbd->pec = calloc(fb_rows(), sizeof(fbd->pec[0]));
+	if (!fbd->bb || !fbd->dsc || !fbd->dec || !fbd->psc || !fbd->pec)
+		goto failed;
+	for (w = 0; w < fb_rows(); w++)
+		fbd->dsc[w] = fbd->psc[w] = fb_cols();
+	fbd->drs = fbd->pdrs = fb_rows();
+	fbd->dre = fbd->pdre = 0;
+	return 0;
+failed:
+	perror("fb_init()");
+	fb_free();
+	return 1;
+}
+
+static void flip_done(int fd, unsigned seq, unsigned sec, unsigned usec, void *data)
+{
+	((struct fbdev *) data)->flipping = 0;
+}
+
+/* wait for the pending page flip */
+static void flip_wait(void)
+{
+	drmEventContext ev = {.version = 2, .page_flip_handler = flip_done};
+	struct pollfd ufds[1];
+	ufds[0].fd = fbd->fd;
+	ufds[0].events = POLLIN;
+	while (fbd->flipping) {
+		int n = poll(ufds, 1, 100);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 1)	/* no vertical blanks; switched out */
+			fbd->flipping = 0;
+		else
+			drmHandleEvent(fbd->fd, &ev);
+	}
+}
+
+void fb_free(void)
+{
+	int i;
+	if (fbd->fd <= 0)
+		return;
+	flip_wait();
+	if (fbd->ocrtc) {
+		drmModeSetCrtc(fbd->fd, fbd->ocrtc->crtc_id, fbd->ocrtc->buffer_id,
+			fbd->ocrtc->x, fbd->ocrtc->y, &fbd->conn, 1, &fbd->ocrtc->mode);
+		drmModeFreeCrtc(fbd->ocrtc);
+	}
+	for (i = 0; i < 2; i++)
+		dbuf_free(&fbd->bufs[i]);
+	free(fbd->bb);
+	free(fbd->dsc);
+	free(fbd->dec);
+	free(fbd->psc);
+	free(fbd->pec);
+	close(fbd->fd);
+	memset(fbd, 0, sizeof(*fbd));
+}
+
+unsigned fb_mode(void)
+{
+	return (BPP << 16) | 0x888;
+}
+
+int fb_rows(void)
+{
+	return fbd->yres;
+}
+
+int fb_cols(void)
+{
+	return fbd->xres;
+}
+
+/* other programs cannot map DRM devices like framebuffers; no FBDEV */
+char *fb_dev(void)
+{
+	return NULL;
+}
+
+/* switching out of the virtual terminal: let others set modes */
+void fb_release(void)
+{
+	flip_wait();
+	drmDropMaster(fbd->fd);
+}
+
+/* the display is shown again after switching virtual terminals */
+void fb_cmap(void)
+{
+	drmSetMaster(fbd->fd);
+	drmModeSetCrtc(fbd->fd, fbd->crtc, fbd->bufs[fbd->front].id, 0, 0,
+		&fbd->conn, 1, &fbd->mode);
+}
+
+unsigned fb_val(int r, int g, int b)
+{
+	return (r << 16) | (g << 8) | b;
+}
+
+void *fb_mem(int r)
+{
+	return fbd->bb + r * fb_cols() * BPP;
+}
+
+/* the back buffer is always used */
+int fb_backbuf(void)
+{
+	return 0;
+}
+
+/* mark n pixels of row r, starting from column c, as changed */
+void fb_damage(int r, int c, int n)
+{
+	if (r < 0 || r >= fb_rows() || n <= 0)
+		return;
+	fbd->dsc[r] = MIN(fbd->dsc[r], MAX(0, c));
+	fbd->dec[r] = MAX(fbd->dec[r], MIN(fb_cols(), c + n));
+	fbd->drs = MIN(fbd->drs, r);
+	fbd->dre = MAX(fbd->dre, r + 1);
+}
+
+/*
+ * Copy the changes to the dumb buffer not on the screen and flip.  It
+ * was shown in the previous frame, so the changes of that frame are
+ * copied too.
+ */
+void fb_flush(void)
+{
+	struct dbuf *b = &fbd->bufs[!fbd->front];
+	int *dsc = fbd->dsc, *dec = fbd->dec;
+	int *psc = fbd->psc, *pec = fbd->pec;
+	int rs = MIN(fbd->drs, fbd->pdrs);
+	int re = MAX(fbd->dre, fbd->pdre);
+	int i;
+	if (fbd->drs >= fbd->dre)
+		return;
+	flip_wait();
+	for (i = rs; i < re; i++) {
+		int sc = MIN(dsc[i], psc[i]);
+		int ec = MAX(dec[i], pec[i]);
+		if (sc < ec)
+			memcpy(b->mem + (fbd->yoff + i) * b->pitch + (fbd->xoff + sc) * BPP,
+				fbd->bb + (i * fb_cols() + sc) * BPP, (ec - sc) * BPP);
+	}
+	if (!drmModePageFlip(fbd->fd, fbd->crtc, b->id, DRM_MODE_PAGE_FLIP_EVENT, fbd)) {
+		fbd->flipping = 1;
+		fbd->front = !fbd->front;
+		for (i = rs; i < re; i++) {
+			psc[i] = dsc[i];
+			pec[i] = dec[i];
+		}
+		fbd->pdrs = fbd->drs;
+		fbd->pdre = fbd->dre;
+	} else {	/* keep the changes for the next frame */
+		for (i = fbd->drs; i < fbd->dre; i++) {
+			psc[i] = MIN(psc[i], dsc[i]);
+			pec[i] = MAX(pec[i], dec[i]);
+		}
+		fbd->pdrs = rs;
+		fbd->pdre = re;
+	}
+	for (i = fbd->drs; i < fbd->dre; i++) {
+		dsc[i] = fb_cols();
+		dec[i] = 0;
+	}
+	fbd->drs = fb_rows();
+	fbd->dre = 0;
+}
+
+/* copy n rows of w pixels from row sr to row dr, starting at column c */
+void fb_copy(int dr, int sr, int n, int c, int w)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		int r = dr > sr ? n - i - 1 : i;
+		memmove((char *) fb_mem(dr + r) + c * BPP,
+			(char *) fb_mem(sr + r) + c * BPP, w * BPP);
+		fb_damage(dr + r, c, w);
+	}
+}
+
+/* other programs cannot draw on the dumb buffers */
+void fb_sync(void)
+{
+	fb_flush();
+}
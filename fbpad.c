@@ -20,7 +20,6 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libssh2.h>
-#include <poll.h>
 #include <pwd.h>
 #include <skalibs/djbunix.h>
 #include <skalibs/exec.h>
@@ -31,9 +30,15 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <linux/vt.h>
 #include "conf.h"
@@ -41,30 +46,62 @@
 #include "draw.h"
 
 #define CTRLKEY(x)	((x) - 96)
-#define POLLFLAGS	(POLLIN | POLLHUP | POLLERR | POLLNVAL)
+#define EVFLAGS		(EPOLLIN | EPOLLHUP | EPOLLERR)
+#define EVSTDIN		(NFBDEV * NTERMS)	/* epoll data of stdin */
+#define EVSIG		(NFBDEV * NTERMS + 1)	/* epoll data of the signalfd */
+#define EVPASS		(NFBDEV * NTERMS + 2)	/* epoll data of passfd */
+#define EVSTAT		(NFBDEV * NTERMS + 3)	/* epoll data of statfd */
+#define EVTERM(i)	(DISP() * NTERMS + (i))	/* epoll data of terminals */
 #define NTAGS		(sizeof(tags) - 1)
 #define NTERMS		(NTAGS * 2)
-#define TERMOPEN(i)	(term_fd(terms[i]))
+#define TERMOPEN(i)	(term_fd(dsp->terms[i]))
 #define TERMSNAP(i)	(strchr(TAGS_SAVED, tags[(i) % NTAGS]))
+#define DISP()		(dsp - disps)	/* the index of the loaded framebuffer */
+#define NBAR		1024		/* the maximum number of status bar columns */
 
 static char tags[] = TAGS;
-static struct term *terms[NTERMS];
-static int tops[NTAGS];		/* top terms of tags */
-static int split[NTAGS];	/* terms are shown together */
-static int ctag;		/* current tag */
-static int ltag;		/* the last tag */
+
+struct cell {
+	int ch, fg, bg;
+};
+/* the terminals and tags of each framebuffer */
+static struct disp {
+	struct term *terms[NTERMS];
+	int tops[NTAGS];	/* top terms of tags */
+	int split[NTAGS];	/* terms are shown together */
+	int pending[NTERMS];	/* terms with undrawn output */
+	int sendwait[NTERMS];	/* terms waiting to accept queued input */
+	long lastframe;		/* the time of the last screen update */
+	int ctag;		/* current tag */
+	int ltag;		/* the last tag */
+	struct cell bar[NBAR];	/* the status bar as drawn */
+	int barcols;		/* the columns of bar[]; zero if it was drawn over */
+} disps[NFBDEV];
+static struct disp *dsp = disps;	/* the loaded framebuffer */
+static int ndisps;		/* the number of framebuffers */
+static int kdisp;		/* the framebuffer receiving the keys */
 static int exitit;
 static int hidden;		/* do not touch the framebuffer */
 static int locked;
 static int taglock;		/* disable tag switching */
 static char pass[1024];
 static int passlen;
+static int passfd = -1;		/* socket to the password checking process */
 static int cmdmode;		/* execute a command and exit */
+static int epfd;		/* epoll instance for stdin, signals and terminals */
+static int sigfd;		/* signalfd for SIGUSR1, SIGUSR2, SIGCHLD and SIGALRM */
+static char ibuf[1024];		/* input buffer */
+static int ilen, icur;		/* input buffer length and offset */
 
 static int barstat;
+static int statbar;		/* show statistics in the status bar */
+static long statms;		/* the time of the last statistics update */
 static int nolock;
 static const char *statfile;
+static int statfd = -1;		/* inotify instance or FIFO of statfile */
+static int statfifo;		/* statfile is a FIFO */
 static const char *scrnfile;
+static char *capfile;		/* the capture log (-r) */
 static char *statline;
 static size_t statsiz;
 static size_t statlen;
@@ -75,22 +112,24 @@ const char *PROG;
 
 static int readchar(void)
 {
-	char b;
-	if (read(0, &b, 1) > 0)
-		return (unsigned char) b;
-	return -1;
+	if (icur == ilen) {
+		icur = 0;
+		if ((ilen = read(0, ibuf, sizeof(ibuf))) < 0)
+			ilen = 0;
+	}
+	return icur < ilen ? (unsigned char) ibuf[icur++] : -1;
 }
 
 /* the current terminal */
 static int cterm(void)
 {
-	return tops[ctag] * NTAGS + ctag;
+	return dsp->tops[dsp->ctag] * NTAGS + dsp->ctag;
 }
 
 /* tag's active terminal */
 static int tterm(int n)
 {
-	return tops[n] * NTAGS + n;
+	return dsp->tops[n] * NTAGS + n;
 }
 
 /* the other terminal in the same tag */
@@ -114,7 +153,7 @@ static int nterm(void)
 /* term struct of cterm() */
 static struct term *tmain(void)
 {
-	return TERMOPEN(cterm()) ? terms[cterm()] : NULL;
+	return TERMOPEN(cterm()) ? dsp->terms[cterm()] : NULL;
 }
 
 #define BRWID		2
@@ -128,12 +167,12 @@ static void t_conf(int idx)
 	int w2 = fb_cols() - w1 - 4 * BRWID;
 	int tag = idx % NTAGS;
 	int top = idx < NTAGS;
-	if (split[tag] == 0)
+	if (dsp->split[tag] == 0)
 		pad_conf(0, 0, fb_rows(), fb_cols());
-	if (split[tag] == 1)
+	if (dsp->split[tag] == 1)
 		pad_conf(top ? BRWID : h1 + 3 * BRWID, BRWID,
 			top ? h1 : h2, fb_cols() - 2 * BRWID);
-	if (split[tag] == 2)
+	if (dsp->split[tag] == 2)
 		pad_conf(BRWID, top ? BRWID : w1 + 3 * BRWID,
 			fb_rows() - 2 * BRWID, top ? w1 : w2);
 }
@@ -141,23 +180,24 @@ static void t_conf(int idx)
 static void t_hide(int idx, int save)
 {
 	if (save && TERMOPEN(idx))
-		term_hide(terms[idx]);
+		term_hide(dsp->terms[idx]);
 	if (save && TERMOPEN(idx) && TERMSNAP(idx))
-		scr_snap(idx);
-	term_save(terms[idx]);
+		scr_snap(EVTERM(idx));
+	term_save(dsp->terms[idx]);
 }
 
-/* show=0 (hidden), show=1 (visible), show=2 (load), show=3 (redraw) */
+/* show=0 (hidden), show=1 (visible), show=2 (load), show=3 (redraw), show=4 (move) */
 static int t_show(int idx, int show)
 {
+	dsp->barcols = 0;
 	t_conf(idx);
-	term_load(terms[idx], show > 0);
+	term_load(dsp->terms[idx], show > 0);
 	if (show == 2)	/* redraw if scr_load() fails */
-		show += !TERMOPEN(idx) || !TERMSNAP(idx) || scr_load(idx);
+		show += !TERMOPEN(idx) || !TERMSNAP(idx) || scr_load(EVTERM(idx));
 	if (show > 0)
-		term_redraw(show == 3);
-	if ((show == 2 || show == 3) && TERMOPEN(idx))
-		term_show(terms[idx]);
+		term_redraw(show == 3 ? 1 : show == 4 ? 2 : 0);
+	if (show >= 2 && TERMOPEN(idx))
+		term_show(dsp->terms[idx]);
 	return show;
 }
 
@@ -168,10 +208,10 @@ static int t_hideshow(int oidx, int save, int nidx, int show)
 	int ntag = nidx % NTAGS;
 	int ret;
 	t_hide(oidx, save);
-	if (show && split[otag] && otag == ntag)
+	if (show && dsp->split[otag] && otag == ntag)
 		pad_border(0, BRWID);
 	ret = t_show(nidx, show);
-	if (show && split[ntag])
+	if (show && dsp->split[ntag])
 		pad_border(BRCLR, BRWID);
 	return ret;
 }
@@ -181,118 +221,293 @@ static void t_set(int n)
 {
 	if (cterm() == n || cmdmode)
 		return;
-	if (taglock && ctag != n % NTAGS)
+	if (taglock && dsp->ctag != n % NTAGS)
 		return;
-	if (ctag != n % NTAGS)
-		ltag = ctag;
-	if (ctag == n % NTAGS) {
-		if (split[n % NTAGS])
+	if (dsp->ctag != n % NTAGS)
+		dsp->ltag = dsp->ctag;
+	if (dsp->ctag == n % NTAGS) {
+		if (dsp->split[n % NTAGS])
 			t_hideshow(cterm(), 0, n, 1);
 		else
 			t_hideshow(cterm(), 1, n, 2);
 	} else {
 		int draw = t_hideshow(cterm(), 1, n, 2);
-		if (split[n % NTAGS]) {
+		if (dsp->split[n % NTAGS]) {
 			t_hideshow(n, 0, aterm(n), draw == 2 ? 1 : 2);
 			t_hideshow(aterm(n), 0, n, 1);
 		}
 	}
-	ctag = n % NTAGS;
-	tops[ctag] = n / NTAGS;
+	dsp->ctag = n % NTAGS;
+	dsp->tops[dsp->ctag] = n / NTAGS;
 }
 
+/* change the split of the current tag; cterm() moves its pixels to its new pad */
 static void t_split(int n)
 {
-	split[ctag] = n;
-	t_hideshow(cterm(), 0, aterm(cterm()), 3);
-	t_hideshow(aterm(cterm()), 1, cterm(), 3);
+	int idx = cterm();
+	int snap = !n && TERMOPEN(aterm(idx)) && TERMSNAP(idx);	/* saved unsplit */
+	dsp->split[dsp->ctag] = n;
+	t_conf(idx);
+	term_redraw(2);
+	if (n || snap)
+		t_hideshow(idx, 0, aterm(idx), 3);
+	t_hideshow(aterm(idx), 1, idx, snap ? 3 : 4);
+}
+
+/* load the terminals and the framebuffer of display d */
+static void d_load(int d)
+{
+	if (d == DISP())
+		return;
+	term_save(dsp->terms[cterm()]);
+	dsp = &disps[d];
+	fb_use(d);
+	pad_switch();
+	t_conf(cterm());
+	term_load(dsp->terms[cterm()], !hidden);
+}
+
+/* add or modify fd in the epoll instance, with data id */
+static int ev_ctl(int op, int fd, int id, int events)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u32 = id;
+	return epoll_ctl(epfd, op, fd, &ev);
 }
 
 static void t_exec(char **args, int swsig)
 {
-	if (!tmain())
+	if (!tmain()) {
+		dsp->barcols = 0;
 		term_exec(args, swsig);
+		if (tmain())
+			ev_ctl(EPOLL_CTL_ADD, term_fd(tmain()), EVTERM(cterm()), EPOLLIN);
+	}
+}
+
+static void bar_put(struct cell *bar, int c, int ch, int fg, int bg)
+{
+	if (c < NBAR) {
+		bar[c].ch = ch;
+		bar[c].fg = fg;
+		bar[c].bg = bg;
+	}
 }
 
+/* draw the status bar; if it is intact, only the cells that have changed */
 static void listtags(void)
 {
 	/* colors for tags based on their number of terminals */
 	int fg = 0x96cb5c, bg = 0x516f7b;
 	int colors[] = {0x173f4f, fg, 0x68cbc0 | FN_B};
+	struct cell bar[NBAR];
+	int cols = MIN(NBAR, pad_cols());
+	int all = dsp->barcols != cols || !term_overdrawn(pad_rows() - 1);
 	int c = 0;
 	int r = pad_rows() - 1;
 	int i;
-	pad_put('T', r, c++, fg | FN_B, bg);
-	pad_put('A', r, c++, fg | FN_B, bg);
-	pad_put('G', r, c++, fg | FN_B, bg);
-	pad_put('S', r, c++, fg | FN_B, bg);
-	pad_put(':', r, c++, fg | FN_B, bg);
-	pad_put(' ', r, c++, fg | FN_B, bg);
+	bar_put(bar, c++, 'T', fg | FN_B, bg);
+	bar_put(bar, c++, 'A', fg | FN_B, bg);
+	bar_put(bar, c++, 'G', fg | FN_B, bg);
+	bar_put(bar, c++, 'S', fg | FN_B, bg);
+	bar_put(bar, c++, ':', fg | FN_B, bg);
+	bar_put(bar, c++, ' ', fg | FN_B, bg);
+	char *stat = statline;
 	int n = MIN(32, statlen);
+	if (statbar) {
+		stat = st_line();
+		n = MIN(pad_cols() / 2, strlen(stat));
+	}
 	for (i = 0; i < NTAGS && c + 2 < pad_cols() - n; i++) {
 		int nt = 0;
 		if (TERMOPEN(i))
 			nt++;
 		if (TERMOPEN(aterm(i)))
 			nt++;
-		pad_put(i == ctag ? '(' : ' ', r, c++, fg, bg);
+		bar_put(bar, c++, i == dsp->ctag ? '(' : ' ', fg, bg);
 		if (TERMSNAP(i))
-			pad_put(tags[i], r, c++, !nt ? bg : colors[nt], colors[0]);
+			bar_put(bar, c++, tags[i], !nt ? bg : colors[nt], colors[0]);
 		else
-			pad_put(tags[i], r, c++, colors[nt], bg);
-		pad_put(i == ctag ? ')' : ' ', r, c++, fg, bg);
+			bar_put(bar, c++, tags[i], colors[nt], bg);
+		bar_put(bar, c++, i == dsp->ctag ? ')' : ' ', fg, bg);
 	}
 	for (; c < pad_cols() - n; c++)
-		pad_put(' ', r, c, fg, bg);
+		bar_put(bar, c, ' ', fg, bg);
 
 	for (i = 0; i < n; i++)
-		pad_put(statline[i], r, c++, fg | FN_B, bg);
+		bar_put(bar, c++, stat[i], fg | FN_B, bg);
+	if (all)
+		term_overdraw(r, r + 1);
+	for (c = 0; c < cols; c++)
+		if (all || memcmp(&bar[c], &dsp->bar[c], sizeof(bar[c])))
+			pad_put(bar[c].ch, r, c, bar[c].fg, bar[c].bg);
+	memcpy(dsp->bar, bar, cols * sizeof(bar[0]));
+	dsp->barcols = cols;
 }
 
-static int chkpass(void)
+/* connect to the ssh server; return NULL on failure */
+static LIBSSH2_SESSION *pass_connect(int *sock)
 {
-	int sock, ret = -1;
 	LIBSSH2_SESSION *session;
-	if (libssh2_init(0)) {
-		strerr_warnwnsys(1, "libssh2_init");
-		return ret;
-	}
-	if ((sock = socket_tcp6_b()) < 0) {
+	if ((*sock = socket_tcp6_b()) < 0) {
 		strerr_warnwunsys(1, "create socket");
-		goto clean1;
+		return NULL;
 	}
-	if (socket_connect6(sock, ipadr, SSHPORT)) {
+	if (socket_connect6(*sock, ipadr, SSHPORT)) {
 		strerr_warnwunsys(1, "connect to socket");
-		goto clean2;
+		goto clean1;
 	}
 	if (!(session = libssh2_session_init())) {
 		strerr_warnwunsys(1, "initialize libssh2 session");
-		goto clean2;
+		goto clean1;
 	}
-	if (libssh2_session_handshake(session, sock)) {
+	if (libssh2_session_handshake(session, *sock)) {
 		strerr_warnwnsys(1, "libssh2 handshake failed");
-		goto clean3;
+		goto clean2;
 	}
-	ret = libssh2_userauth_password(session, pw->pw_name, pass);
+	return session;
+clean2:
+	libssh2_session_free(session);
+clean1:
+	fd_close(*sock);
+	return NULL;
+}
+
+static void pass_close(LIBSSH2_SESSION *session, int sock)
+{
 	libssh2_session_disconnect(session, "Fbpad normal disconnect");
-clean3:
 	libssh2_session_free(session);
-clean2:
 	fd_close(sock);
-clean1:
-	libssh2_exit();
+}
 
-	if (ret) {
-		if (ret < 0)
-			return ret;
-		else
+/* read a nul-terminated message; return nonzero at the end of input */
+static int pass_read(int fd, char *buf, int len)
+{
+	int n = 0;
+	while (n < len && read(fd, buf + n, 1) == 1)
+		if (!buf[n++])
 			return 0;
-	} else
+	return 1;
+}
+
+/*
+ * The password checking process: for each password read from fd,
+ * it writes '1' if it is correct and '0' otherwise.  The connection
+ * to the ssh server is made in advance, when an empty message is
+ * received, and is reused after failed attempts.
+ */
+static void pass_helper(int fd)
+{
+	LIBSSH2_SESSION *session = NULL;
+	char buf[sizeof(pass)];
+	int sock = -1;
+	int init = !libssh2_init(0);
+	if (!init)
+		strerr_warnwnsys(1, "libssh2_init");
+	while (!pass_read(fd, buf, sizeof(buf))) {
+		int check = buf[0] != '\0';
+		int ret = -1;
+		int i;
+		/* reconnect once if the server has dropped the connection */
+		for (i = 0; init && i < 2; i++) {
+			if (!session && !(session = pass_connect(&sock)))
+				break;
+			if (!check)
+				break;
+			ret = libssh2_userauth_password(session, pw->pw_name, buf);
+			if (!ret || ret == LIBSSH2_ERROR_AUTHENTICATION_FAILED)
+				break;
+			pass_close(session, sock);
+			session = NULL;
+		}
+		if (!ret) {
+			pass_close(session, sock);
+			session = NULL;
+		}
+		memset(buf, 0, sizeof(buf));
+		if (check && write(fd, ret ? "0" : "1", 1) != 1)
+			break;
+	}
+	if (session)
+		pass_close(session, sock);
+	if (init)
+		libssh2_exit();
+}
+
+/* start the password checking process */
+static int pass_start(void)
+{
+	int fds[2];
+	int pid;
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds))
 		return 1;
+	if ((pid = fork()) == -1) {
+		close(fds[0]);
+		close(fds[1]);
+		return 1;
+	}
+	if (!pid) {
+		int i;
+		for (i = 0; i < ndisps * NTERMS; i++)
+			if (term_fd(disps[i / NTERMS].terms[i % NTERMS]))
+				close(term_fd(disps[i / NTERMS].terms[i % NTERMS]));
+		close(epfd);
+		close(sigfd);
+		close(fds[0]);
+		cap_forget();
+		pass_helper(fds[1]);
+		_exit(0);
+	}
+	close(fds[1]);
+	passfd = fds[0];
+	ev_ctl(EPOLL_CTL_ADD, passfd, EVPASS, EPOLLIN);
+	return 0;
+}
+
+/* send a password to be checked; the results are read in pass_done() */
+static void pass_send(char *s)
+{
+	int i;
+	for (i = 0; i < 2; i++) {
+		if (passfd < 0 && pass_start()) {
+			strerr_warnwunsys(1, "start password checking");
+			return;
+		}
+		if (send(passfd, s, strlen(s) + 1, MSG_NOSIGNAL) >= 0 || errno != EPIPE)
+			return;
+		close(passfd);		/* the helper exited; start another */
+		passfd = -1;
+	}
 }
 
+/* read the result of checking the password */
+static void pass_done(void)
+{
+	char c;
+	if (read(passfd, &c, 1) == 1) {
+		if (c == '1')
+			locked = 0;
+	} else {
+		close(passfd);
+		passfd = -1;
+	}
+}
+
+#if STATS
+/* save the statistics next to screenshots */
+static void st_dumpfile(void)
+{
+	char path[1024];
+	snprintf(path, sizeof(path), "%s.stats", scrnfile);
+	st_dump(path);
+}
+#endif
+
 static void togglebar(void)
 {
+	dsp->barcols = 0;
 	barstat *= -1;
 	if (barstat < 0)
 		term_redraw(1);
@@ -317,7 +532,94 @@ static void update_status(void)
 	}
 }
 
+/* read the lines written to the statfile FIFO; the last one is shown */
+static void status_fifo(void)
+{
+	static char buf[1024];
+	static int len;
+	char *nl, *line;
+	int n, up = 0;
+	while ((n = read(statfd, buf + len, sizeof(buf) - len)) > 0) {
+		len += n;
+		while ((nl = memchr(buf, '\n', len))) {
+			n = nl - buf + 1;
+			if (statsiz < n && (line = realloc(statline, n))) {
+				statline = line;
+				statsiz = n;
+			}
+			if (statsiz >= n) {
+				memcpy(statline, buf, n);
+				statline[n - 1] = ' ';
+				statlen = n;
+				up = 1;
+			}
+			len -= n;
+			memmove(buf, buf + n, len);
+		}
+		if (len == sizeof(buf))		/* too long */
+			len = 0;
+	}
+	if (up && barstat > 0 && !hidden)
+		listtags();
+}
+
+/* read statfile when it is written */
+static void status_changed(void)
+{
+	char buf[4096];
+	char *base = strrchr(statfile, '/') ? strrchr(statfile, '/') + 1 : (char *) statfile;
+	int up = 0;
+	int i, n;
+	if (statfifo) {
+		status_fifo();
+		return;
+	}
+	while ((n = read(statfd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i + sizeof(struct inotify_event) <= n; ) {
+			struct inotify_event ev;
+			memcpy(&ev, buf + i, sizeof(ev));
+			if (ev.len && !strcmp(buf + i + sizeof(ev), base))
+				up = 1;
+			i += sizeof(ev) + ev.len;
+		}
+	}
+	if (up)
+		update_status();
+}
+
+/*
+ * Watch statfile in the main loop: a FIFO is read as lines are written
+ * to it and a regular file is read again when inotify reports that it
+ * is written or replaced.  SIGALRM rereads regular files too.
+ */
+static void status_init(void)
+{
+	char dir[1024];
+	char *slash;
+	struct stat st;
+	if (!stat(statfile, &st) && S_ISFIFO(st.st_mode)) {
+		statfifo = 1;
+		/* opened for writing too, so that writers closing it cause no EOF */
+		statfd = open(statfile, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	} else {
+		update_status();
+		snprintf(dir, sizeof(dir), "%s", statfile);
+		if ((slash = strrchr(dir, '/')))
+			slash[slash == dir] = '\0';
+		if ((statfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0 &&
+				inotify_add_watch(statfd, slash ? dir : ".",
+					IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+			close(statfd);
+			statfd = -1;
+		}
+	}
+	if (statfd >= 0)
+		ev_ctl(EPOLL_CTL_ADD, statfd, EVSTAT, EPOLLIN);
+}
+
+/* commands may draw over the status bar */
 #define STAT_RET do {	\
+	dsp->barcols = 0;	\
 	if (barstat > 0)	\
 		listtags();		\
 	return;				\
@@ -332,8 +634,8 @@ static void directkey(void)
 	if (!nolock && locked) {
 		if (c == '\r') {
 			pass[passlen] = '\0';
-			if (chkpass() > 0)
-				locked = 0;
+			pass_send(pass);
+			memset(pass, 0, passlen);
 			passlen = 0;
 			return;
 		}
@@ -360,7 +662,7 @@ static void directkey(void)
 			t_set(aterm(cterm()));
 			return;
 		case 'o':
-			t_set(tterm(ltag));
+			t_set(tterm(dsp->ltag));
 			STAT_RET;
 		case 'p':
 			togglebar();
@@ -388,18 +690,38 @@ static void directkey(void)
 		case CTRLKEY('l'):
 			locked = 1;
 			passlen = 0;
+			if (!nolock)
+				pass_send("");
 			return;
 		case CTRLKEY('o'):
 			taglock = 1 - taglock;
 			return;
+		case 'd':
+			kdisp = (kdisp + 1) % ndisps;
+			d_load(kdisp);
+			STAT_RET;
+#if STATS
+		case 'g':
+			statbar = !statbar;
+			if (barstat < 0)
+				togglebar();
+			else
+				listtags();
+			return;
+		case CTRLKEY('g'):
+			st_dumpfile();
+			return;
+#endif
 		case ',':
 			term_scrl(pad_rows() / 2);
+			dsp->barcols = 0;
 			return;
 		case '.':
 			term_scrl(-pad_rows() / 2);
+			dsp->barcols = 0;
 			return;
 		case '=':
-			t_split(split[ctag] == 1 ? 2 : 1);
+			t_split(dsp->split[dsp->ctag] == 1 ? 2 : 1);
 			return;
 		case '-':
 			t_split(0);
@@ -417,66 +739,218 @@ static void directkey(void)
 		term_send(c);
 }
 
+/* load termid in place of cterm(), to draw or end it */
 static void peepterm(int termid)
 {
-	int visible = !hidden && ctag == (termid % NTAGS) && split[ctag];
-	if (termid != cterm())
-		t_hideshow(cterm(), 0, termid, visible);
+	int visible = !hidden && dsp->ctag == (termid % NTAGS) && dsp->split[dsp->ctag];
+	if (termid != cterm()) {
+		term_save(dsp->terms[cterm()]);
+		t_conf(termid);
+		term_load(dsp->terms[termid], visible);
+	}
 }
 
 static void peepback(int termid)
 {
-	if (termid != cterm())
-		t_hideshow(termid, 0, cterm(), !hidden);
+	if (termid != cterm()) {
+		term_save(dsp->terms[termid]);
+		t_conf(cterm());
+		term_load(dsp->terms[cterm()], !hidden);
+	}
 }
 
-static int pollterms(void)
+/* the current time in milliseconds */
+static long mstime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* draw the output of visible terminals */
+static void t_flush(void)
+{
+	int a = aterm(cterm());
+	if (!hidden && dsp->pending[cterm()])
+		term_flush();
+	if (!hidden && dsp->split[dsp->ctag] && dsp->pending[a]) {
+		peepterm(a);
+		term_flush();
+		peepback(a);
+	}
+	memset(dsp->pending, 0, sizeof(dsp->pending));
+	dsp->lastframe = mstime();
+	if (statbar && barstat >= 0 && !hidden && dsp->lastframe - statms >= 1000) {
+		statms = dsp->lastframe;
+		listtags();
+	}
+}
+
+/* milliseconds until the next screen update of ds, or -1 if none is pending */
+static int t_frame(struct disp *ds)
 {
-	struct pollfd ufds[NTERMS + 1];
-	int term_idx[NTERMS + 1];
 	int i;
-	int n = 1;
-	ufds[0].fd = 0;
-	ufds[0].events = POLLIN;
-	for (i = 0; i < NTERMS; i++) {
-		if (TERMOPEN(i)) {
-			ufds[n].fd = term_fd(terms[i]);
-			ufds[n].events = POLLIN;
-			term_idx[n++] = i;
-		}
+	for (i = 0; i < NTERMS; i++)
+		if (ds->pending[i])
+			return MAX(0, ds->lastframe + 1000 / FPS - mstime());
+	return -1;
+}
+
+/* milliseconds until the next screen update of any display */
+static int d_frame(void)
+{
+	int wait = -1;
+	int d;
+	for (d = 0; d < ndisps; d++) {
+		int w = t_frame(&disps[d]);
+		if (w >= 0 && (wait < 0 || w < wait))
+			wait = w;
 	}
-	if (poll(ufds, n, 1000) < 1)
-		return 0;
-	if (ufds[0].revents & (POLLFLAGS & ~POLLIN))
-		return 1;
-	if (ufds[0].revents & POLLIN)
+	return wait;
+}
+
+/* update the displays whose frames are due; each has its own frame clock */
+static void d_flush(void)
+{
+	int d;
+	for (d = 0; d < ndisps; d++) {
+		if (d != kdisp && t_frame(&disps[d]))
+			continue;
+		d_load(d);
+		if (!t_frame(dsp))
+			t_flush();
+		if (!hidden)
+			fb_flush();
+	}
+	d_load(kdisp);
+}
+
+static void signalreceived(int n);
+
+/* handle pending signals; they are blocked and read from sigfd */
+static void readsignals(void)
+{
+	struct signalfd_siginfo si;
+	while (read(sigfd, &si, sizeof(si)) == sizeof(si))
+		signalreceived(si.ssi_signo);
+}
+
+/* handle the keys typed so far */
+static void readkeys(void)
+{
+	int n = 0;
+	while (!exitit && (icur < ilen || (!ioctl(0, FIONREAD, &n) && n > 0))) {
+		d_load(kdisp);
 		directkey();
-	for (i = 1; i < n; i++) {
-		if (!(ufds[i].revents & POLLFLAGS))
+	}
+}
+
+/* write the input queued for terminals; poll them for EPOLLOUT if they are full */
+static void t_send(void)
+{
+	int i;
+	for (i = 0; i < ndisps * NTERMS; i++) {
+		struct disp *ds = &disps[i / NTERMS];
+		struct term *t = ds->terms[i % NTERMS];
+		int left = term_fd(t) && term_sendq(t) > 0;
+		if (left != ds->sendwait[i % NTERMS] && term_fd(t))
+			ev_ctl(EPOLL_CTL_MOD, term_fd(t), i,
+				left ? EPOLLIN | EPOLLOUT : EPOLLIN);
+		ds->sendwait[i % NTERMS] = left;
+	}
+}
+
+/*
+ * Events are level-triggered: term_read() reads at most PTYLEN bytes,
+ * and with edge-triggered events the rest of a long output would wait
+ * for the next write of the program.
+ *
+ * Keys are handled before reading terminals and again before reading
+ * each of them, so that a busy terminal does not delay the input.  The
+ * bytes sent to terminals are queued and written once per iteration.
+ */
+static int pollterms(void)
+{
+	struct epoll_event evs[NFBDEV * NTERMS + 4];
+	int wait = d_frame();
+	int i, n;
+	ST_START(t);
+	d_flush();
+#if STATS
+	if (!wait)
+		st_frame(t);
+#endif
+	t_send();
+	cap_flush();
+	ST_STOP(ST_POLL, t, 0);
+	if ((n = epoll_wait(epfd, evs, LEN(evs), wait)) < 1)
+		return 0;
+	ST_START(t2);
+	for (i = 0; i < n; i++) {
+		int id = evs[i].data.u32;
+		int ev = evs[i].events;
+		if (id == EVSTDIN && ev & (EPOLLHUP | EPOLLERR))
+			return 1;
+		if (id == EVSTDIN) {
+			directkey();
+			readkeys();
+		}
+		if (id == EVSIG)
+			readsignals();
+		if (id == EVPASS)
+			pass_done();
+		if (id == EVSTAT)
+			status_changed();
+	}
+	for (i = 0; i < n; i++) {
+		int id = evs[i].data.u32;
+		int ev = evs[i].events;
+		if (id >= ndisps * NTERMS || !(ev & EVFLAGS))
 			continue;
-		peepterm(term_idx[i]);
-		if (ufds[i].revents & POLLIN) {
-			term_read();
+		readkeys();
+		d_load(id / NTERMS);
+		id %= NTERMS;
+		if (!TERMOPEN(id))
+			continue;
+		if (ev & EPOLLIN) {
+			if (id == cterm())
+				term_read();
+			else
+				term_readbg(dsp->terms[id], BGREAD);
+			dsp->pending[id] = 1;
 		} else {
-			scr_free(term_idx[i]);
+			epoll_ctl(epfd, EPOLL_CTL_DEL, term_fd(dsp->terms[id]), NULL);
+			peepterm(id);
+			scr_free(EVTERM(id));
 			term_end();
+			peepback(id);
+			if (barstat > 0 && !hidden)
+				listtags();
 			if (cmdmode)
 				exitit = 1;
 		}
-		peepback(term_idx[i]);
 	}
+	d_load(kdisp);
+	ST_STOP(ST_POLL, t2, 1);
 	return 0;
 }
 
 static void mainloop(char **args)
 {
 	struct termios oldtermios, termios;
+	int d;
 	tcgetattr(0, &termios);
 	oldtermios = termios;
 	cfmakeraw(&termios);
 	tcsetattr(0, TCSAFLUSH, &termios);
-	term_load(terms[cterm()], 1);
+	term_load(dsp->terms[cterm()], 1);
 	term_redraw(1);
+	for (d = 1; d < ndisps; d++) {
+		d_load(d);
+		term_redraw(1);
+		fb_flush();
+	}
+	d_load(kdisp);
 	if (args) {
 		cmdmode = 1;
 		t_exec(args, 0);
@@ -489,28 +963,40 @@ static void mainloop(char **args)
 
 static void signalreceived(int n)
 {
+	int d;
 	if (exitit)
 		return;
 	switch (n) {
 	case SIGUSR1:
 		hidden = 1;
-		t_hide(cterm(), 1);
+		for (d = 0; d < ndisps; d++) {
+			d_load(d);
+			t_hide(cterm(), 1);
+			fb_flush();
+			fb_release();
+		}
+		d_load(kdisp);
 		ioctl(0, VT_RELDISP, 1);
 		break;
 	case SIGUSR2:
 		hidden = 0;
-		fb_cmap();
-		if (t_show(cterm(), 2) == 3 && split[ctag]) {
-			t_hideshow(cterm(), 0, aterm(cterm()), 3);
-			t_hideshow(aterm(cterm()), 0, cterm(), 1);
+		for (d = 0; d < ndisps; d++) {
+			d_load(d);
+			fb_cmap();
+			if (t_show(cterm(), 2) == 3 && dsp->split[dsp->ctag]) {
+				t_hideshow(cterm(), 0, aterm(cterm()), 3);
+				t_hideshow(aterm(cterm()), 0, cterm(), 1);
+			}
+			fb_flush();
 		}
+		d_load(kdisp);
 		break;
 	case SIGCHLD:
 		while (waitpid(-1, NULL, WNOHANG) > 0)
 			;
 		break;
 	case SIGALRM:
-		if (statfile)
+		if (statfile && !statfifo)
 			update_status();
 		break;
 	}
@@ -519,18 +1005,46 @@ static void signalreceived(int n)
 static void signalsetup(void)
 {
 	struct vt_mode vtm;
+	sigset_t set;
 	vtm.mode = VT_PROCESS;
 	vtm.waitv = 0;
 	vtm.relsig = SIGUSR1;
 	vtm.acqsig = SIGUSR2;
 	vtm.frsig = 0;
-	signal(SIGUSR1, signalreceived);
-	signal(SIGUSR2, signalreceived);
-	signal(SIGCHLD, signalreceived);
-	signal(SIGALRM, signalreceived);
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGUSR2);
+	sigaddset(&set, SIGCHLD);
+	sigaddset(&set, SIGALRM);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+			(sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+			ev_ctl(EPOLL_CTL_ADD, 0, EVSTDIN, EPOLLIN) ||
+			ev_ctl(EPOLL_CTL_ADD, sigfd, EVSIG, EPOLLIN))
+		strerr_diefunsys(EXIT_FAILURE, 1, "set up the event loop");
 	ioctl(0, VT_SETMODE, &vtm);
 }
 
+/* open the framebuffers in devs, separated by commas */
+static int d_init(char *devs)
+{
+	char *dev = devs;
+	do {
+		char *next = dev ? strchr(dev, ',') : NULL;
+		if (next)
+			*next++ = '\0';
+		fb_use(ndisps);
+		if (fb_init(dev))
+			return 1;
+		if (BACKBUF && fb_backbuf())
+			strerr_warnwunsys(1, "allocate the back buffer");
+		ndisps++;
+		dev = next;
+	} while (dev && ndisps < NFBDEV);
+	fb_use(0);
+	return 0;
+}
+
 static void user_init(stralloc *sta)
 {
 	if ((pw = getpwuid(geteuid()))) {
@@ -565,33 +1079,53 @@ int main(int argc, char **argv)
 	char *hide = "\x1b[2J\x1b[H\x1b[?25l";
 	char *show = "\x1b[?25h";
 	char **args = argv + 1;
-	int i;
-	if (fb_init(getenv("FBDEV")))
+	int i, d;
+	if (d_init(getenv("FBDEV")))
 		strerr_diefn(EXIT_FAILURE, 1, "failed to initialize the framebuffer");
-	if (pad_init())
+	if (STATS)
+		st_init();
+	if (pad_init(FR, FI, FB))
 		strerr_diefn(EXIT_FAILURE, 1, "cannot find fonts");
-	if ((statfile = getenv("FBPAD_STATUS"))) {
+	if (getenv("FBPAD_HIST"))
+		term_histsize(atoi(getenv("FBPAD_HIST")));
+	if ((statfile = getenv("FBPAD_STATUS")))
 		barstat = -1;
-		update_status();
+	for (d = ndisps - 1; d >= 0; d--) {
+		fb_use(d);
+		pad_switch();
+		for (i = 0; i < NTERMS; i++)
+			disps[d].terms[i] = term_make();
 	}
-	for (i = 0; i < NTERMS; i++)
-		terms[i] = term_make();
 	write(1, hide, strlen(hide));
 	signalsetup();
+	if (statfile)
+		status_init();
 	fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
 	while (args[0] && args[0][0] == '-') {
 		if (args[0][1] == 'u')
 			nolock = 1;
+		if (args[0][1] == 'r' && args[1])
+			capfile = *++args;
 		args++;
 	}
+	if (capfile && cap_open(capfile))
+		strerr_warnwunsys(1, "open the capture log");
+	else if (capfile)
+		for (i = 0; i < ndisps * NTERMS; i++)
+			term_capture(disps[i / NTERMS].terms[i % NTERMS], i);
 	togglebar();
 	mainloop(args[0] ? args : NULL);
+	cap_close();
 	write(1, show, strlen(show));
-	for (i = 0; i < NTERMS; i++)
-		term_free(terms[i]);
+	for (i = 0; i < ndisps * NTERMS; i++)
+		term_free(disps[i / NTERMS].terms[i % NTERMS]);
 	pad_free();
 	scr_done();
-	fb_free();
+	pool_done();
+	for (d = 0; d < ndisps; d++) {
+		fb_use(d);
+		fb_free();
+	}
 	stralloc_free(&strafile);
 	free(statline);
 	if ((statline = getenv("STATUS_PID")))
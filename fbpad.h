@@ -5,13 +5,13 @@
 #define LEN(a)		(sizeof(a) / sizeof((a)[0]))
 
 #define ESC		27		/* escape code */
-#define NHIST		128		/* scrolling history lines */
 
 /* isdw.c */
 #define DWCHAR		0x40000000u	/* 2nd half of a fullwidth char */
 
 int isdw(int c);
 int iszw(int c);
+int chwid(int c);
 
 /* term.c */
 struct term *term_make(void);
@@ -21,43 +21,105 @@ void term_save(struct term *term);
 int term_fd(struct term *term);
 void term_hide(struct term *term);
 void term_show(struct term *term);
+void term_readbg(struct term *term, int max);
+int term_sendq(struct term *term);
 /* operations on the loaded terminal */
 void term_read(void);
+int term_feed(char *s, int n, int len);
+void term_flush(void);
 void term_send(int c);
 void term_exec(char **args, int swsig);
 void term_end(void);
 void term_screenshot(const char *path, int a);
 void term_scrl(int pos);
 void term_redraw(int all);
+void term_histsize(int n);
+void term_overdraw(int sr, int er);
+int term_overdrawn(int r);
+void term_capture(struct term *term, int id);
 int term_colors(char *path);
 
 /* pad.c */
 #define FN_I		0x01000000	/* italic font */
 #define FN_B		0x02000000	/* bold font */
 #define FN_C		0x00ffffff	/* font color mask */
+#define FN_P		0x04000000	/* the color is an index into the palette */
+#define NPAL		0x400		/* the number of palette colors */
 
-int pad_init(void);
+int pad_init(char *fr, char *fi, char *fb);
 void pad_free(void);
 void pad_conf(int row, int col, int rows, int cols);
+void pad_switch(void);
 int pad_font(char *fr, char *fi, char *fb);
 void pad_put(int ch, int r, int c, int fg, int bg);
 int pad_rows(void);
 int pad_cols(void);
 void pad_fill(int sr, int er, int sc, int ec, int c);
+void pad_scroll(int sr, int er, int n);
+void pad_blit(int roff, int coff, int sr, int nr, int nc);
 void pad_border(unsigned c, int wid);
 char *pad_fbdev(void);
 int pad_crows(void);
 int pad_ccols(void);
+int pad_roff(void);
+int pad_coff(void);
+void pad_palette(int *rgb, int n);
+void pad_gcstat(unsigned long *hits, unsigned long *misses, unsigned long *evicts);
+unsigned long pad_cells(void);
 
 /* font.c */
 struct font *font_open(char *path);
 void font_free(struct font *font);
 int font_rows(struct font *font);
 int font_cols(struct font *font);
-int font_bitmap(struct font *font, void *dst, int c);
+char *font_glyph(struct font *font, int c);
 
 /* scrsnap.c */
 void scr_snap(int idx);
 int scr_load(int idx);
 void scr_free(int idx);
 void scr_done(void);
+
+/* pool.c: large buffers in size classes; released buffers are reused */
+void *pool_get(long sz);
+void pool_put(void *p);
+void pool_done(void);
+
+/* cap.c: capturing the output of terminals, for fbbench -r */
+#define CAPMAGIC	"fbpadcap"
+#define CAPDROP		-1	/* the terminal of records of dropped bytes */
+
+int cap_open(char *path);
+void cap_put(int id, char *s, int n);
+void cap_flush(void);
+void cap_forget(void);
+void cap_close(void);
+
+/* stats.c: counters and timers of hot paths, if STATS is nonzero */
+#define ST_READ		0	/* term_read(): bytes */
+#define ST_FLUSH	1	/* lazy_flush() */
+#define ST_PUT		2	/* pad_put() */
+#define ST_GCGET	3	/* gc_get(), not timed */
+#define ST_GCPUT	4	/* gc_put() and glyph rendering */
+#define ST_FBSET	5	/* fb_set(): pixels, not timed */
+#define ST_POLL		6	/* pollterms(), except epoll_wait() */
+#define ST_FRAME	7	/* screen updates */
+#define ST_N		8
+
+#if STATS
+#define ST_START(t)		unsigned long long t = st_clock()
+#define ST_STOP(i, t, n)	(st_cnt[i] += (n), st_tm[i] += st_clock() - (t))
+#define ST_ADD(i, n)		(st_cnt[i] += (n))
+#else
+#define ST_START(t)
+#define ST_STOP(i, t, n)
+#define ST_ADD(i, n)
+#endif
+
+extern unsigned long st_cnt[ST_N];
+extern unsigned long long st_tm[ST_N];
+unsigned long long st_clock(void);
+void st_init(void);
+void st_frame(unsigned long long t);
+char *st_line(void);
+int st_dump(char *path);
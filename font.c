@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "fbpad.h"
 
 struct font {
@@ -10,6 +12,11 @@ struct font {
 	int n;		/* number of font glyphs */
 	int *glyphs;	/* glyph unicode character codes */
 	char *data;	/* glyph bitmaps */
+	void *map;	/* the mapped font file */
+	long len;	/* the length of map */
+	int *bmp[256];	/* glyph indices of the basic multilingual plane */
+	int *ast;	/* a hash table of astral glyph indices */
+	int astn;	/* the size of ast; a power of two */
 };
 
 /*
@@ -25,73 +32,111 @@ struct tinyfont {
 	int rows, cols;	/* glyph dimensions */
 };
 
-static void *xread(int fd, int len)
+#define ASTHASH(c)	((unsigned) (c) * 2654435761u)
+
+/* the address of glyph c's index in font lookup tables */
+static int *glyph_slot(struct font *font, int c)
+{
+	int i;
+	if (c < 0x10000)
+		return font->bmp[c >> 8] ? &font->bmp[c >> 8][c & 0xff] : NULL;
+	if (!font->astn)
+		return NULL;
+	i = ASTHASH(c) & (font->astn - 1);
+	while (font->ast[i] >= 0 && font->glyphs[font->ast[i]] != c)
+		i = (i + 1) & (font->astn - 1);
+	return &font->ast[i];
+}
+
+/* fill glyph lookup tables */
+static int font_index(struct font *font)
 {
-	void *buf = malloc(len);
-	if (buf && read(fd, buf, len) == len)
-		return buf;
-	free(buf);
-	return NULL;
+	int nast = 0;
+	int i, c;
+	for (i = 0; i < font->n; i++) {
+		c = font->glyphs[i];
+		if (c >= 0x10000)
+			nast++;
+		if (c >= 0 && c < 0x10000 && !font->bmp[c >> 8]) {
+			if (!(font->bmp[c >> 8] = malloc(256 * sizeof(int))))
+				return 1;
+			memset(font->bmp[c >> 8], 0xff, 256 * sizeof(int));
+		}
+	}
+	if (nast) {
+		for (font->astn = 16; font->astn < nast * 2; font->astn <<= 1)
+			;
+		if (!(font->ast = malloc(font->astn * sizeof(int))))
+			return 1;
+		memset(font->ast, 0xff, font->astn * sizeof(int));
+	}
+	for (i = 0; i < font->n; i++) {
+		int *slot = font->glyphs[i] >= 0 ? glyph_slot(font, font->glyphs[i]) : NULL;
+		if (slot && *slot < 0)
+			*slot = i;
+	}
+	return 0;
 }
 
 struct font *font_open(char *path)
 {
 	struct font *font;
-	struct tinyfont head;
+	struct tinyfont *head;
+	struct stat st;
+	void *map;
 	int fd = open(path, O_RDONLY);
-	if (fd < 0 || read(fd, &head, sizeof(head)) != sizeof(head)) {
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < sizeof(*head)) {
 		close(fd);
 		return NULL;
 	}
-	font = malloc(sizeof(*font));
-	font->n = head.n;
-	font->rows = head.rows;
-	font->cols = head.cols;
-	font->glyphs = xread(fd, font->n * sizeof(int));
-	font->data = xread(fd, font->n * font->rows * font->cols);
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
 	close(fd);
-	if (!font->glyphs || !font->data) {
+	if (map == MAP_FAILED)
+		return NULL;
+	head = map;
+	if (head->n < 0 || head->rows <= 0 || head->cols <= 0 ||
+			(st.st_size - sizeof(*head)) / (sizeof(int) +
+				(long) head->rows * head->cols) < head->n) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	if (!(font = calloc(1, sizeof(*font)))) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	font->map = map;
+	font->len = st.st_size;
+	font->n = head->n;
+	font->rows = head->rows;
+	font->cols = head->cols;
+	font->glyphs = (void *) (head + 1);
+	font->data = (void *) (font->glyphs + font->n);
+	if (font_index(font)) {
 		font_free(font);
 		return NULL;
 	}
 	return font;
 }
 
-static int find_glyph(struct font *font, int c)
-{
-	int l = 0;
-	int h = font->n;
-	while (l < h) {
-		int m = (l + h) / 2;
-		if (font->glyphs[m] == c)
-			return m;
-		if (c < font->glyphs[m])
-			h = m;
-		else
-			l = m + 1;
-	}
-	return -1;
-}
-
-int font_bitmap(struct font *font, void *dst, int c)
+/* the bitmap of glyph c or NULL */
+char *font_glyph(struct font *font, int c)
 {
-	int i = find_glyph(font, c);
-	int len = font->rows * font->cols;
-	if (i < 0)
-		return 1;
-	memcpy(dst, font->data + i * len, len);
-	return 0;
+	int *slot = c >= 0 ? glyph_slot(font, c) : NULL;
+	return slot && *slot >= 0 ? font->data + *slot * font->rows * font->cols : NULL;
 }
 
 void font_free(struct font *font)
 {
-	if (font && font->data)
-		free(font->data);
-	if (font && font->glyphs)
-		free(font->glyphs);
+	int i;
+	if (!font)
+		return;
+	for (i = 0; i < LEN(font->bmp); i++)
+		free(font->bmp[i]);
+	free(font->ast);
+	if (font->map)
+		munmap(font->map, font->len);
 	free(font);
 }
-
 int font_rows(struct font *font)
 {
 	return font->rows;
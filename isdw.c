@@ -1,3 +1,4 @@
+#include <string.h>
 #include "fbpad.h"
 
 static int dwchars[][2] = {
@@ -83,14 +84,51 @@ static int find(int c, int tab[][2], int n)
 	return 0;
 }
 
+#define WTOP	(0xe0200 >> 8)	/* blocks covered by the width table */
+#define WBLK	128		/* maximum number of distinct blocks */
+
+static unsigned char wtop[WTOP];	/* the width block of each 256 characters */
+static unsigned char wblk[WBLK][256];	/* character widths in each block */
+static int wblk_n;
+
+/* fill the two-level width table from dwchars and zwchars */
+static void wid_init(void)
+{
+	unsigned char blk[256];
+	int i, j, k;
+	for (i = 0; i < WTOP; i++) {
+		for (j = 0; j < 256; j++) {
+			int c = (i << 8) | j;
+			blk[j] = find(c, dwchars, LEN(dwchars)) ? 2 :
+				find(c, zwchars, LEN(zwchars)) ? 0 : 1;
+		}
+		for (k = 0; k < wblk_n; k++)
+			if (!memcmp(wblk[k], blk, sizeof(blk)))
+				break;
+		if (k == wblk_n && wblk_n < WBLK)
+			memcpy(wblk[wblk_n++], blk, sizeof(blk));
+		wtop[i] = k < WBLK ? k : 0;
+	}
+}
+
+/* the number of columns occupied by character c: 0, 1, or 2 */
+int chwid(int c)
+{
+	if (c < 0x0300)
+		return 1;
+	if (!wblk_n)
+		wid_init();
+	return c < (WTOP << 8) ? wblk[wtop[c >> 8]][c & 0xff] : 1;
+}
+
 /* double-width characters */
 int isdw(int c)
 {
-	return c >= 0x1100 && find(c, dwchars, LEN(dwchars));
+	return chwid(c) == 2;
 }
 
 /* zero-width and combining characters */
 int iszw(int c)
 {
-	return c >= 0x0300 && find(c, zwchars, LEN(zwchars));
+	return chwid(c) == 0;
 }
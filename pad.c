@@ -2,6 +2,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 #include "conf.h"
 #include "draw.h"
 #include "fbpad.h"
@@ -10,15 +16,29 @@ static int fbroff, fbcoff, fbrows, fbcols;
 static int rows, cols;
 static int fnrows, fncols;
 static int bpp;
+static unsigned fbfmt[4];	/* fb_mode() and FB_VAL() of primary colours */
 static struct font *fonts[3];
+static int palrgb[NPAL];	/* palette colours */
+static unsigned palfb[NPAL];	/* framebuffer values of palette colours */
 
 static int gc_init(void);
 static void gc_free(void);
 static void gc_refresh(void);
+static void pixfmt_init(void);
+static void pal_init(void);
+static char *rowbuf(unsigned c, int len);
 
-int pad_init(void)
+static void fbfmt_get(unsigned *fmt)
 {
-	if (pad_font(FR, FI, FB))
+	fmt[0] = fb_mode();
+	fmt[1] = FB_VAL(255, 0, 0);
+	fmt[2] = FB_VAL(0, 255, 0);
+	fmt[3] = FB_VAL(0, 0, 255);
+}
+
+int pad_init(char *fr, char *fi, char *fb)
+{
+	if (pad_font(fr, fi, fb))
 		return 1;
 	fnrows = font_rows(fonts[0]);
 	fncols = font_cols(fonts[0]);
@@ -26,11 +46,30 @@ int pad_init(void)
 		return 1;
 	rows = fb_rows() / fnrows;
 	cols = fb_cols() / fncols;
+	fbfmt_get(fbfmt);
 	bpp = FBM_BPP(fb_mode());
+	pixfmt_init();
+	pal_init();
 	pad_conf(0, 0, fb_rows(), fb_cols());
 	return 0;
 }
 
+/* draw on the framebuffer selected with fb_use(); fonts and, if the
+ * pixel formats are the same, cached glyphs are shared between them */
+void pad_switch(void)
+{
+	unsigned fmt[4];
+	fbfmt_get(fmt);
+	if (memcmp(fmt, fbfmt, sizeof(fmt))) {
+		memcpy(fbfmt, fmt, sizeof(fmt));
+		bpp = FBM_BPP(fb_mode());
+		pixfmt_init();
+		pal_init();
+		gc_refresh();
+	}
+	pad_conf(0, 0, fb_rows(), fb_cols());
+}
+
 void pad_conf(int roff, int coff, int _rows, int _cols)
 {
 	fbroff = roff;
@@ -47,6 +86,7 @@ void pad_free(void)
 	font_free(fonts[0]);
 	font_free(fonts[1]);
 	font_free(fonts[2]);
+	memset(fonts, 0, sizeof(fonts));
 }
 
 #define CR(a)		(((a) >> 16) & 0x0000ff)
@@ -54,35 +94,278 @@ void pad_free(void)
 #define CB(a)		((a) & 0x0000ff)
 #define COLORMERGE(f, b, c)		((b) + (((f) - (b)) * (c) >> 8u))
 
+/* the colors of a glyph */
+struct mix {
+	int fg, bg;		/* foreground and background colors */
+	unsigned f, b;		/* framebuffer values of fg and bg */
+	unsigned val[256];	/* framebuffer values of mixed colors */
+	char set[256];		/* whether val[] is computed */
+};
+
+/* functions specialized for a framebuffer pixel format */
+struct pixfmt {
+	unsigned mode;		/* fb_mode() of the format */
+	/* the framebuffer value of a color */
+	unsigned (*val)(int r, int g, int b);
+	/* blend n alpha values from s, mixing m's colors, into d */
+	void (*blend)(char *d, unsigned char *s, int n, struct mix *m);
+	/* store n pixels of value c in d */
+	void (*fill)(char *d, unsigned c, int n);
+};
+
+static struct pixfmt *pf;	/* the format of the framebuffer */
+
 static unsigned mixed_color(int fg, int bg, unsigned val)
 {
 	unsigned char r = COLORMERGE(CR(fg), CR(bg), val);
 	unsigned char g = COLORMERGE(CG(fg), CG(bg), val);
 	unsigned char b = COLORMERGE(CB(fg), CB(bg), val);
-	return FB_VAL(r, g, b);
+	return pf->val(r, g, b);
+}
+
+/* the RGB value of c, which may be a palette index */
+static int color2rgb(int c)
+{
+	return c & FN_P ? palrgb[c & (NPAL - 1)] : c & FN_C;
 }
 
 static unsigned color2fb(int c)
 {
-	return FB_VAL(CR(c), CG(c), CB(c));
+	if (c & FN_P)
+		return palfb[c & (NPAL - 1)];
+	return pf->val(CR(c), CG(c), CB(c));
+}
+
+static void pal_init(void)
+{
+	int i;
+	for (i = 0; i < NPAL; i++)
+		palfb[i] = pf->val(CR(palrgb[i]), CG(palrgb[i]), CB(palrgb[i]));
+}
+
+/* set the first n colours of the palette */
+void pad_palette(int *rgb, int n)
+{
+	n = MIN(n, NPAL);
+	if (!memcmp(palrgb, rgb, n * sizeof(rgb[0])))
+		return;
+	memcpy(palrgb, rgb, n * sizeof(rgb[0]));
+	if (pf)
+		pal_init();
+	gc_refresh();
+}
+
+static void mix_init(struct mix *m, int fg, int bg)
+{
+	m->fg = color2rgb(fg);
+	m->bg = color2rgb(bg);
+	m->f = color2fb(fg);
+	m->b = color2fb(bg);
+	memset(m->set, 0, sizeof(m->set));
+}
+
+static unsigned mix_val(struct mix *m, unsigned v)
+{
+	if (!m->set[v]) {
+		m->val[v] = mixed_color(m->fg, m->bg, v);
+		m->set[v] = 1;
+	}
+	return m->val[v];
+}
+
+static void blend_any(char *d, unsigned char *s, int n, struct mix *m)
+{
+	int i, k;
+	for (i = 0; i < n; i++) {
+		unsigned c = mix_val(m, s[i]);
+		for (k = 0; k < bpp; k++)	/* little-endian */
+			*d++ = (c >> (k << 3)) & 0xff;
+	}
+}
+
+static void blend_16(char *d, unsigned char *s, int n, struct mix *m)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		unsigned short c = mix_val(m, s[i]);
+		memcpy(d + i * 2, &c, 2);
+	}
+}
+
+static void blend_32(char *d, unsigned char *s, int n, struct mix *m)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		unsigned c = mix_val(m, s[i]);
+		memcpy(d + i * 4, &c, 4);
+	}
+}
+
+/* mix the bytes of f and b; equivalent to mixed_color() for 8-bit channels */
+static unsigned mix_888(unsigned f, unsigned b, unsigned v)
+{
+	unsigned rb = ((f & 0xff00ff) * v + (b & 0xff00ff) * (256 - v)) >> 8;
+	unsigned xg = (((f >> 8) & 0xff00ff) * v + ((b >> 8) & 0xff00ff) * (256 - v)) >> 8;
+	return (rb & 0xff00ff) | ((xg & 0xff00ff) << 8);
+}
+
+/* four bytes per pixel and eight bits per color */
+static void blend_888(char *d, unsigned char *s, int n, struct mix *m)
+{
+	int i = 0;
+#ifdef __SSE2__
+	__m128i z = _mm_setzero_si128();
+	__m128i f = _mm_unpacklo_epi8(_mm_set1_epi32(m->f), z);
+	__m128i b = _mm_unpacklo_epi8(_mm_set1_epi32(m->b), z);
+	__m128i k = _mm_set1_epi16(256);
+	for (; i + 4 <= n; i += 4) {	/* (f * v + b * (256 - v)) >> 8 */
+		int v4;
+		__m128i v, lo, hi;
+		memcpy(&v4, s + i, 4);
+		v = _mm_cvtsi32_si128(v4);
+		v = _mm_unpacklo_epi8(v, v);
+		v = _mm_unpacklo_epi16(v, v);
+		lo = _mm_unpacklo_epi8(v, z);
+		hi = _mm_unpackhi_epi8(v, z);
+		lo = _mm_add_epi16(_mm_mullo_epi16(f, lo),
+			_mm_mullo_epi16(b, _mm_sub_epi16(k, lo)));
+		hi = _mm_add_epi16(_mm_mullo_epi16(f, hi),
+			_mm_mullo_epi16(b, _mm_sub_epi16(k, hi)));
+		lo = _mm_srli_epi16(lo, 8);
+		hi = _mm_srli_epi16(hi, 8);
+		_mm_storeu_si128((void *) (d + i * 4), _mm_packus_epi16(lo, hi));
+	}
+#endif
+#ifdef __ARM_NEON
+	uint8x8_t f = vreinterpret_u8_u32(vdup_n_u32(m->f));
+	uint8x8_t b = vreinterpret_u8_u32(vdup_n_u32(m->b));
+	for (; i + 2 <= n; i += 2) {	/* (f * v + b * (255 - v) + b) >> 8 */
+		uint32x2_t v2 = vdup_n_u32(s[i] * 0x01010101u);
+		uint8x8_t v = vreinterpret_u8_u32(vset_lane_u32(s[i + 1] * 0x01010101u, v2, 1));
+		uint16x8_t x = vaddq_u16(vmull_u8(f, v), vmull_u8(b, vmvn_u8(v)));
+		vst1_u8((void *) (d + i * 4), vshrn_n_u16(vaddw_u8(x, b), 8));
+	}
+#endif
+	for (; i < n; i++) {
+		unsigned c = mix_888(m->f, m->b, s[i]);
+		memcpy(d + i * 4, &c, 4);
+	}
+}
+
+/* three bytes per pixel and eight bits per color */
+static void blend_24(char *d, unsigned char *s, int n, struct mix *m)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		unsigned c = mix_888(m->f, m->b, s[i]);
+		*d++ = c;
+		*d++ = c >> 8;
+		*d++ = c >> 16;
+	}
+}
+
+static unsigned val_any(int r, int g, int b)
+{
+	return FB_VAL(r, g, b);
+}
+
+static unsigned val_rgb(int r, int g, int b)
+{
+	return (r << 16) | (g << 8) | b;
+}
+
+static unsigned val_bgr(int r, int g, int b)
+{
+	return (b << 16) | (g << 8) | r;
+}
+
+static unsigned val_565(int r, int g, int b)
+{
+	return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+}
+
+static void fill_any(char *d, unsigned c, int n)
+{
+	int i, k;
+	for (i = 0; i < n; i++)
+		for (k = 0; k < bpp; k++)	/* little-endian */
+			*d++ = (c >> (k * 8)) & 0xff;
+}
+
+static void fill_16(char *d, unsigned c, int n)
+{
+	unsigned short v = c;
+	int i;
+	for (i = 0; i < n; i++)
+		memcpy(d + i * 2, &v, 2);
+}
+
+static void fill_24(char *d, unsigned c, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		*d++ = c;
+		*d++ = c >> 8;
+		*d++ = c >> 16;
+	}
+}
+
+static void fill_32(char *d, unsigned c, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		memcpy(d + i * 4, &c, 4);
+}
+
+static struct pixfmt pixfmts[] = {
+	{0x040888, val_rgb, blend_888, fill_32},	/* xRGB8888 */
+	{0x740888, val_bgr, blend_888, fill_32},	/* xBGR8888 */
+	{0x020565, val_565, blend_16, fill_16},		/* RGB565 */
+	{0x030888, val_rgb, blend_24, fill_24},		/* RGB888 */
+};
+
+static struct pixfmt pixany = {0, val_any, blend_any, fill_any};
+
+/* choose the functions for the framebuffer format, if its colors match */
+static void pixfmt_init(void)
+{
+	int i;
+	pf = &pixany;
+	pixany.blend = bpp == 2 ? blend_16 : (bpp == 4 ? blend_32 : blend_any);
+	for (i = 0; i < LEN(pixfmts); i++) {
+		struct pixfmt *p = &pixfmts[i];
+		if (p->mode == fb_mode() && p->val(255, 0, 0) == FB_VAL(255, 0, 0) &&
+				p->val(0, 255, 0) == FB_VAL(0, 255, 0) &&
+				p->val(0, 0, 255) == FB_VAL(0, 0, 255))
+			pf = p;
+	}
 }
 
-/* glyph bitmap cache: use CGLCNT lists of size CGLLEN each */
-#define GCLCNT		(1 << 7)		/* glyph cache list count */
-#define GCLLEN		(1 << 4)		/* glyph cache list length */
+/* glyph bitmap cache: an open addressing hash table with CLOCK eviction;
+ * font bitmaps are blended into the framebuffer directly, if GCSIZE is zero */
 #define GCGLEN		(fnrows * fncols * 4)	/* bytes to store a glyph */
-#define GCN		(GCLCNT * GCLLEN)	/* total glpyhs */
-#define GCIDX(c)	((c) & (GCLCNT - 1))
+#define GCN		(GCSIZE ? GCSIZE : 1)	/* total glyphs */
+#define GCH		(GCN * 2)		/* hash table size */
 
 static char *gc_mem;		/* cached glyph's memory */
-static int gc_next[GCLCNT];	/* the next slot to use in each list */
+static int gc_tab[GCH];		/* hash table; indices of cached glyphs or -1 */
+static int gc_cnt;		/* number of used slots */
+static int gc_hand;		/* the clock hand */
 static int gc_glyph[GCN];	/* cached glyphs */
-static int gc_bg[GCN];
+static int gc_fn[GCN];
 static int gc_fg[GCN];
+static int gc_bg[GCN];
+static unsigned gc_hash[GCN];	/* hash table index of cached glyphs */
+static char gc_ref[GCN];	/* recently used */
+static unsigned long gc_hits, gc_misses, gc_evicts;
+static unsigned long ncells;	/* the number of cells drawn */
 
 static int gc_init(void)
 {
-	gc_mem = malloc(GCLCNT * GCLLEN * GCGLEN);
+	gc_refresh();
+	if (!GCSIZE)
+		return 0;
+	gc_mem = malloc(GCN * GCGLEN);
 	return !gc_mem;
 }
 
@@ -91,79 +374,131 @@ static void gc_free(void)
 	free(gc_mem);
 }
 
-static char *gc_get(int c, int fg, int bg)
+static unsigned gc_idx(int fn, int c, int fg, int bg)
 {
-	int idx = GCIDX(c) * GCLLEN;
-	int i;
-	for (i = idx; i < idx + GCLLEN; i++)
-		if (gc_glyph[i] == c && gc_fg[i] == fg && gc_bg[i] == bg)
-			return gc_mem + i * GCGLEN;
-	return NULL;
+	unsigned h = c * 0x9e3779b1u;
+	h ^= (fg + (fn << 28)) * 0x85ebca6bu;
+	h ^= bg * 0xc2b2ae35u;
+	h ^= h >> 15;
+	return h % GCH;
 }
 
-static char *gc_put(int c, int fg, int bg)
+static char *gc_get(int fn, int c, int fg, int bg)
 {
-	int lst = GCIDX(c);
-	int pos = gc_next[lst]++;
-	int idx = lst * GCLLEN + pos;
-	if (gc_next[lst] >= GCLLEN)
-		gc_next[lst] = 0;
-	gc_glyph[idx] = c;
-	gc_fg[idx] = fg;
-	gc_bg[idx] = bg;
-	return gc_mem + idx * GCGLEN;
+	int i = gc_idx(fn, c, fg, bg);
+	int g;
+	for (; (g = gc_tab[i]) >= 0; i = (i + 1) % GCH) {
+		if (gc_glyph[g] == c && gc_fg[g] == fg && gc_bg[g] == bg && gc_fn[g] == fn) {
+			gc_ref[g] = 1;
+			gc_hits++;
+			return gc_mem + g * GCGLEN;
+		}
+	}
+	gc_misses++;
+	return NULL;
 }
 
-static void gc_refresh(void)
+/* remove glyph g from the hash table, shifting back the entries after it */
+static void gc_unlink(int g)
 {
-	memset(gc_next, 0, sizeof(gc_next));
-	memset(gc_glyph, 0, sizeof(gc_glyph));
+	int i = gc_hash[g];
+	int j;
+	while (gc_tab[i] != g)
+		i = (i + 1) % GCH;
+	gc_tab[i] = -1;
+	for (j = (i + 1) % GCH; gc_tab[j] >= 0; j = (j + 1) % GCH) {
+		int k = gc_hash[gc_tab[j]];
+		/* move to i, unless k lies cyclically in (i, j] */
+		if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+			gc_tab[i] = gc_tab[j];
+			gc_tab[j] = -1;
+			i = j;
+		}
+	}
 }
 
-static void bmp2fb(char *d, char *s, int fg, int bg, int nr, int nc)
+static char *gc_put(int fn, int c, int fg, int bg)
 {
-	int i, j, k;
-	for (i = 0; i < fnrows; i++) {
-		char *p = d + i * fncols * bpp;
-		for (j = 0; j < fncols; j++) {
-			unsigned v = i < nr && j < nc ?
-				(unsigned char) s[i * nc + j] : 0;
-			unsigned c = mixed_color(fg, bg, v);
-			for (k = 0; k < bpp; k++)	/* little-endian */
-				*p++ = (c >> (k << 3)) & 0xff;
+	int i = gc_idx(fn, c, fg, bg);
+	int g;
+	if (gc_cnt < GCN) {
+		g = gc_cnt++;
+	} else {
+		while (gc_ref[gc_hand]) {
+			gc_ref[gc_hand] = 0;
+			gc_hand = (gc_hand + 1) % GCN;
 		}
+		g = gc_hand;
+		gc_hand = (gc_hand + 1) % GCN;
+		gc_unlink(g);
+		gc_evicts++;
 	}
+	gc_glyph[g] = c;
+	gc_fn[g] = fn;
+	gc_fg[g] = fg;
+	gc_bg[g] = bg;
+	gc_hash[g] = i;
+	gc_ref[g] = 1;
+	while (gc_tab[i] >= 0)
+		i = (i + 1) % GCH;
+	gc_tab[i] = g;
+	return gc_mem + g * GCGLEN;
+}
+
+static void gc_refresh(void)
+{
+	memset(gc_tab, 0xff, sizeof(gc_tab));
+	gc_cnt = 0;
+	gc_hand = 0;
 }
 
-static char *ch2fb(int fn, int c, int fg, int bg)
+/* glyph cache hits, misses and evictions */
+void pad_gcstat(unsigned long *hits, unsigned long *misses, unsigned long *evicts)
 {
-	static char bits[1024 * 4];
-	char *fbbits;
+	*hits = gc_hits;
+	*misses = gc_misses;
+	*evicts = gc_evicts;
+}
+
+/* the number of cells drawn by pad_put() and pad_fill() */
+unsigned long pad_cells(void)
+{
+	return ncells;
+}
+
+/* blend row i of bitmap s with nr rows and nc columns into d */
+static void bmp2row(char *d, char *s, int nr, int nc, int i, struct mix *m)
+{
+	int n = i < nr ? MIN(nc, fncols) : 0;
+	if (n)
+		pf->blend(d, (unsigned char *) s + i * nc, n, m);
+	if (n < fncols)
+		memcpy(d + n * bpp, rowbuf(m->b, fncols - n), (fncols - n) * bpp);
+}
+
+/* the bitmap of c in font *fn, or in the regular font if it is missing */
+static char *ch2bmp(int *fn, int c)
+{
+	char *bits;
 	if (c < 0 || (c < 128 && (!isprint(c) || isspace(c))))
 		return NULL;
-	if ((fbbits = gc_get(c, fg, bg)))
-		return fbbits;
-	if (font_bitmap(fonts[fn], bits, c))
-		return NULL;
-	fbbits = gc_put(c, fg, bg);
-	bmp2fb(fbbits, bits, fg & FN_C, bg & FN_C,
-		font_rows(fonts[fn]), font_cols(fonts[fn]));
-	return fbbits;
+	if ((bits = font_glyph(fonts[*fn], c)))
+		return bits;
+	*fn = 0;
+	return font_glyph(fonts[0], c);
 }
 
 static void fb_set(int r, int c, void *mem, int len)
 {
 	memcpy(fb_mem(fbroff + r) + (fbcoff + c) * bpp, mem, len * bpp);
+	fb_damage(fbroff + r, fbcoff + c, len);
+	ST_ADD(ST_FBSET, len);		/* too frequent to be timed */
 }
 
 static char *rowbuf(unsigned c, int len)
 {
 	static char row[32 * 1024];
-	char *p = row;
-	int i, k;
-	for (i = 0; i < len; i++)
-		for (k = 0; k < bpp; k++)	/* little-endian */
-			*p++ = (c >> (k * 8)) & 0xff;
+	pf->fill(row, c, len);
 	return row;
 }
 
@@ -177,7 +512,7 @@ static void fb_box(int sr, int er, int sc, int ec, unsigned val)
 
 void pad_border(unsigned c, int wid)
 {
-	int v = color2fb(c & FN_C);
+	int v = color2fb(c);
 	if (fbroff < wid || fbcoff < wid)
 		return;
 	fb_box(-wid, 0, -wid, fbcols + wid, v);
@@ -195,27 +530,92 @@ static int fnsel(int fg, int bg)
 	return 0;
 }
 
-void pad_put(int ch, int r, int c, int fg, int bg)
+static void glyph_put(int ch, int r, int c, int fg, int bg)
 {
 	int sr = fnrows * r;
 	int sc = fncols * c;
+	int fn = fnsel(fg, bg);
+	int gn = fn;
+	char *fbbits = NULL;
 	char *bits;
+	struct mix m;
 	int i;
-	bits = ch2fb(fnsel(fg, bg), ch, fg, bg);
-	if (!bits)
-		bits = ch2fb(0, ch, fg, bg);
-	if (!bits)
-		fb_box(sr, sr + fnrows, sc, sc + fncols, color2fb(bg & FN_C));
-	else
+	if (GCSIZE) {
+		fbbits = gc_get(fn, ch, fg, bg);
+		ST_ADD(ST_GCGET, 1);	/* timed as part of pad_put() */
+	}
+	if (!fbbits) {
+		if (!(bits = ch2bmp(&gn, ch))) {
+			fb_box(sr, sr + fnrows, sc, sc + fncols, color2fb(bg));
+			return;
+		}
+		mix_init(&m, fg, bg);
+		if (!GCSIZE) {	/* blend the glyph directly into the framebuffer */
+			for (i = 0; i < fnrows; i++) {
+				bmp2row(fb_mem(fbroff + sr + i) + (fbcoff + sc) * bpp, bits,
+					font_rows(fonts[gn]), font_cols(fonts[gn]), i, &m);
+				fb_damage(fbroff + sr + i, fbcoff + sc, fncols);
+			}
+			return;
+		}
+		ST_START(t);
+		fbbits = gc_put(fn, ch, fg, bg);
 		for (i = 0; i < fnrows; i++)
-			fb_set(sr + i, sc, bits + (i * fncols * bpp), fncols);
+			bmp2row(fbbits + i * fncols * bpp, bits,
+				font_rows(fonts[gn]), font_cols(fonts[gn]), i, &m);
+		ST_STOP(ST_GCPUT, t, 1);
+	}
+	for (i = 0; i < fnrows; i++)
+		fb_set(sr + i, sc, fbbits + (i * fncols * bpp), fncols);
+}
+
+void pad_put(int ch, int r, int c, int fg, int bg)
+{
+	ST_START(t);
+	glyph_put(ch, r, c, fg, bg);
+	ncells++;
+	ST_STOP(ST_PUT, t, 1);
 }
 
 void pad_fill(int sr, int er, int sc, int ec, int c)
 {
 	int fber = er >= 0 ? er * fnrows : fbrows;
 	int fbec = ec >= 0 ? ec * fncols : fbcols;
-	fb_box(sr * fnrows, fber, sc * fncols, fbec, color2fb(c & FN_C));
+	ncells += ((er >= 0 ? er : pad_rows()) - sr) * ((ec >= 0 ? ec : pad_cols()) - sc);
+	fb_box(sr * fnrows, fber, sc * fncols, fbec, color2fb(c));
+}
+
+/* move rows sr to er by n rows */
+void pad_scroll(int sr, int er, int n)
+{
+	fb_copy(fbroff + (sr + n) * fnrows, fbroff + sr * fnrows,
+		(er - sr) * fnrows, fbcoff, fbcols);
+}
+
+/* move the pixels of nr rows and nc columns from row sr of the pad at (roff, coff) */
+void pad_blit(int roff, int coff, int sr, int nr, int nc)
+{
+	int sy = roff + sr * fnrows;
+	int n = nr * fnrows;
+	int i;
+	if (sy == fbroff && coff == fbcoff)
+		return;
+	for (i = 0; i < n; i++) {
+		int r = fbroff > sy ? n - i - 1 : i;
+		memmove(fb_mem(fbroff + r) + fbcoff * bpp, fb_mem(sy + r) + coff * bpp,
+			nc * fncols * bpp);
+		fb_damage(fbroff + r, fbcoff, nc * fncols);
+	}
+}
+
+int pad_roff(void)
+{
+	return fbroff;
+}
+
+int pad_coff(void)
+{
+	return fbcoff;
 }
 
 int pad_rows(void)
@@ -243,9 +643,12 @@ int pad_font(char *fr, char *fi, char *fb)
 	return 0;
 }
 
+/* the FBDEV variable of terminals or NULL */
 char *pad_fbdev(void)
 {
 	static char fbdev[1024];
+	if (!fb_dev())
+		return NULL;
 	snprintf(fbdev, sizeof(fbdev), "FBDEV=%s:%dx%d%+d%+d",
 		fb_dev(), fbcols, fbrows, fbcoff, fbroff);
 	return fbdev;
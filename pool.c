@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "fbpad.h"
+
+#define PHEAD		16		/* the size of block headers */
+#define PMIN		12		/* the smallest class: 1 << PMIN bytes */
+#define NCLS		20		/* the number of classes */
+#define PKEEP		(64 << 20)	/* the maximum size of released blocks */
+#define HUGESZ		(2 << 20)	/* the size of huge pages */
+
+struct pblk {
+	int cls;		/* block class */
+	struct pblk *next;	/* the next released block */
+};
+
+static struct pblk *pfree[NCLS];	/* released blocks of each class */
+static long pkept;			/* the size of released blocks */
+
+static long pool_size(int cls)
+{
+	return 1l << (PMIN + cls);
+}
+
+/* allocate a buffer of at least sz bytes */
+void *pool_get(long sz)
+{
+	struct pblk *b;
+	int cls = 0;
+	while (cls < NCLS && pool_size(cls) < sz + PHEAD)
+		cls++;
+	if (cls == NCLS)
+		return NULL;
+	if ((b = pfree[cls])) {
+		pfree[cls] = b->next;
+		pkept -= pool_size(cls);
+		return (char *) b + PHEAD;
+	}
+	b = mmap(NULL, pool_size(cls), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	if (pool_size(cls) >= HUGESZ)
+		madvise(b, pool_size(cls), MADV_HUGEPAGE);
+#endif
+	b->cls = cls;
+	return (char *) b + PHEAD;
+}
+
+/* release a buffer returned by pool_get() */
+void pool_put(void *p)
+{
+	struct pblk *b;
+	if (!p)
+		return;
+	b = (void *) ((char *) p - PHEAD);
+	if (pkept + pool_size(b->cls) > PKEEP) {
+		munmap(b, pool_size(b->cls));
+		return;
+	}
+	b->next = pfree[b->cls];
+	pfree[b->cls] = b;
+	pkept += pool_size(b->cls);
+}
+
+void pool_done(void)
+{
+	int i;
+	for (i = 0; i < NCLS; i++) {
+		while (pfree[i]) {
+			struct pblk *b = pfree[i];
+			pfree[i] = b->next;
+			munmap(b, pool_size(i));
+		}
+	}
+	pkept = 0;
+}
@@ -1,37 +1,207 @@
 #include <stdlib.h>
 #include <string.h>
 #include "draw.h"
+#include "fbpad.h"
 
 #define NSCRS		128
+#define TOKMAX		0x7fff		/* the maximum number of pixels in a token */
+#define MATCH		0x8000		/* the token copies earlier pixels */
+#define MINMATCH	4		/* the minimum length of copied pixels */
+#define HBITS		15		/* the size of the match hash table */
 
+/*
+ * Snapshots are compressed with a simple LZ77 variant, row by row.
+ * Each token is an unsigned short: either n, followed by n literal
+ * pixels, or MATCH | n, followed by the int index (r * fb_cols() + c)
+ * of the first of n pixels to copy from a previous position.  Copied
+ * pixels never cross row boundaries, so they can be decoded straight
+ * into the framebuffer.
+ */
 static void *scrs[NSCRS];
+static int htab[1 << HBITS];	/* the last position of pixel quadruples */
+static char *ebuf;		/* the snapshot being encoded */
+static long elen, ecap;
+
+static int pxeq(char *a, char *b, int bpp)
+{
+	unsigned int x, y;
+	unsigned short p, q;
+	if (bpp == 4) {
+		memcpy(&x, a, 4);
+		memcpy(&y, b, 4);
+		return x == y;
+	}
+	if (bpp == 2) {
+		memcpy(&p, a, 2);
+		memcpy(&q, b, 2);
+		return p == q;
+	}
+	return !memcmp(a, b, bpp);
+}
+
+static int pxhash(char *s, int bpp)
+{
+	unsigned int h = 0, v;
+	int i;
+	for (i = 0; i < MINMATCH * bpp; i += 2) {
+		v = (unsigned char) s[i] | ((unsigned char) s[i + 1] << 8);
+		h = (h ^ v) * 2654435761u;
+	}
+	return h >> (32 - HBITS);
+}
+
+/* append n bytes to ebuf */
+static int eput(void *s, long n)
+{
+	char *buf;
+	if (elen + n > ecap) {
+		long cap = MAX(ecap * 2, elen + n);
+		if (!(buf = pool_get(cap)))
+			return 1;
+		memcpy(buf, ebuf, elen);
+		pool_put(ebuf);
+		ebuf = buf;
+		ecap = cap;
+	}
+	memcpy(ebuf + elen, s, n);
+	elen += n;
+	return 0;
+}
+
+static int elit(char *s, int n, int bpp)
+{
+	unsigned short tok;
+	while (n > 0) {
+		tok = MIN(n, TOKMAX);
+		if (eput(&tok, sizeof(tok)) || eput(s, tok * bpp))
+			return 1;
+		s += tok * bpp;
+		n -= tok;
+	}
+	return 0;
+}
+
+static int erow(int r, int bpp)
+{
+	char *s = fb_mem(r);
+	int n = fb_cols();
+	int lit = 0, c = 0;
+	int h, k, len, max;
+	unsigned short tok;
+	while (c < n) {
+		len = 0;
+		if (c + MINMATCH <= n) {
+			h = pxhash(s + c * bpp, bpp);
+			k = htab[h];
+			htab[h] = r * n + c;
+			if (k >= 0) {
+				char *p = (char *) fb_mem(k / n) + k % n * bpp;
+				max = MIN(TOKMAX, MIN(n - c, n - k % n));
+				while (len < max && pxeq(p + len * bpp, s + (c + len) * bpp, bpp))
+					len++;
+			}
+		}
+		if (len < MINMATCH) {
+			c++;
+			continue;
+		}
+		tok = MATCH | len;
+		if (elit(s + lit * bpp, c - lit, bpp) ||
+				eput(&tok, sizeof(tok)) || eput(&k, sizeof(k)))
+			return 1;
+		c += len;
+		lit = c;
+	}
+	return elit(s + lit * bpp, n - lit, bpp);
+}
+
+/* decode row r from s and return the end of its tokens */
+static char *drow(int r, char *s, int bpp)
+{
+	char *d = fb_mem(r);
+	int n = fb_cols();
+	int c = 0, len, k, sc, m;
+	unsigned short tok;
+	while (c < n) {
+		memcpy(&tok, s, sizeof(tok));
+		s += sizeof(tok);
+		len = tok & TOKMAX;
+		if (~tok & MATCH) {
+			memcpy(d + c * bpp, s, len * bpp);
+			s += len * bpp;
+			c += len;
+			continue;
+		}
+		memcpy(&k, s, sizeof(k));
+		s += sizeof(k);
+		sc = k % n;
+		if (k / n != r) {
+			memcpy(d + c * bpp, (char *) fb_mem(k / n) + sc * bpp, len * bpp);
+			c += len;
+			continue;
+		}
+		while (len > 0) {	/* overlapping pixels of the same row */
+			m = MIN(len, c - sc);
+			memcpy(d + c * bpp, d + sc * bpp, m * bpp);
+			c += m;
+			sc += m;
+			len -= m;
+		}
+	}
+	return s;
+}
 
 void scr_snap(int idx)
 {
-	int rowsz = FBM_BPP(fb_mode()) * fb_cols();
+	int bpp = FBM_BPP(fb_mode());
+	char *buf;
 	int i;
-	if (idx < NSCRS && !scrs[idx])
-		scrs[idx] = malloc(fb_rows() * rowsz);
-	if (idx < NSCRS && scrs[idx])
-		for (i = 0; i < fb_rows(); i++)
-			memcpy(scrs[idx] + i * rowsz, fb_mem(i), rowsz);
+	if (idx >= NSCRS)
+		return;
+	fb_sync();
+	elen = 0;
+	ecap = fb_rows() * fb_cols() * bpp / 16 + 4096;
+	if (!(ebuf = pool_get(ecap))) {
+		scr_free(idx);		/* a stale snapshot is worse than none */
+		return;
+	}
+	memset(htab, 0xff, sizeof(htab));
+	for (i = 0; i < fb_rows(); i++) {
+		if (erow(i, bpp)) {
+			pool_put(ebuf);
+			scr_free(idx);
+			return;
+		}
+	}
+	if ((buf = pool_get(elen))) {	/* keep only the encoded bytes */
+		memcpy(buf, ebuf, elen);
+		pool_put(ebuf);
+		ebuf = buf;
+	}
+	scr_free(idx);
+	scrs[idx] = ebuf;
 }
 
 void scr_free(int idx)
 {
 	if (idx < NSCRS) {
-		free(scrs[idx]);
+		pool_put(scrs[idx]);
 		scrs[idx] = NULL;
 	}
 }
 
 int scr_load(int idx)
 {
-	int rowsz = FBM_BPP(fb_mode()) * fb_cols();
+	int bpp = FBM_BPP(fb_mode());
+	char *s;
 	int i;
-	if (idx < NSCRS && scrs[idx])
-		for (i = 0; i < fb_rows(); i++)
-			memcpy(fb_mem(i), scrs[idx] + i * rowsz, rowsz);
+	if (idx >= NSCRS || !scrs[idx])
+		return 1;
+	s = scrs[idx];
+	for (i = 0; i < fb_rows(); i++) {
+		s = drow(i, s, bpp);
+		fb_damage(i, 0, fb_cols());
+	}
 	return 0;
 }
 
@@ -39,5 +209,5 @@ void scr_done(void)
 {
 	int i;
 	for (i = 0; i < NSCRS; i++)
-		free(scrs[i]);
+		pool_put(scrs[i]);
 }
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+#include "conf.h"
+#include "fbpad.h"
+
+#define NFRAMES		1024	/* the number of frames kept for percentiles */
+
+unsigned long st_cnt[ST_N];		/* event counts or bytes */
+unsigned long long st_tm[ST_N];		/* clock ticks spent */
+
+static char *st_names[] = {
+	"term_read", "lazy_flush", "pad_put", "gc_get", "gc_put",
+	"fb_set", "pollterms", "frame",
+};
+static unsigned long long st_frames[NFRAMES];	/* the ticks of recent frames */
+static int st_nframes;
+static unsigned long long st_tick0;	/* ticks at st_init() */
+static double st_ns0;			/* monotonic nanoseconds at st_init() */
+static unsigned long st_lcnt[ST_N];	/* counts at the last st_line() */
+static unsigned long long st_ltick;	/* ticks at the last st_line() */
+static char st_buf[128];
+
+static double ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* a cheap clock for timing hot paths */
+unsigned long long st_clock(void)
+{
+#ifdef __x86_64__
+	return __rdtsc();
+#else
+	return ns();
+#endif
+}
+
+void st_init(void)
+{
+	st_tick0 = st_clock();
+	st_ltick = st_tick0;
+	st_ns0 = ns();
+}
+
+/* nanoseconds per clock tick, measured since st_init() */
+static double st_nspt(void)
+{
+	unsigned long long t = st_clock();
+	return t > st_tick0 ? (ns() - st_ns0) / (t - st_tick0) : 1;
+}
+
+/* record a frame that started at tick t */
+void st_frame(unsigned long long t)
+{
+	t = st_clock() - t;
+	st_cnt[ST_FRAME]++;
+	st_tm[ST_FRAME] += t;
+	st_frames[st_nframes++ % NFRAMES] = t;
+}
+
+static int tickcmp(const void *a, const void *b)
+{
+	unsigned long long x = *(unsigned long long *) a;
+	unsigned long long y = *(unsigned long long *) b;
+	return x < y ? -1 : x > y;
+}
+
+/* the p-th percentile of recent frame times in ticks */
+static unsigned long long st_pct(int p)
+{
+	static unsigned long long s[NFRAMES];
+	int n = MIN(st_nframes, NFRAMES);
+	if (!n)
+		return 0;
+	memcpy(s, st_frames, n * sizeof(s[0]));
+	qsort(s, n, sizeof(s[0]), tickcmp);
+	return s[(n - 1) * p / 100];
+}
+
+static double st_hits(void)
+{
+	unsigned long h, m, e;
+	pad_gcstat(&h, &m, &e);
+	return 100.0 * h / MAX(1, h + m);
+}
+
+/* a summary of the statistics of the last second or more, for the status bar */
+char *st_line(void)
+{
+	double nspt = st_nspt();
+	unsigned long long t = st_clock();
+	double sec = (t - st_ltick) * nspt / 1e9;
+	if (sec < 1 && st_buf[0])
+		return st_buf;
+	snprintf(st_buf, sizeof(st_buf), "%.1fKB/s %.0ffl/s %.1f%%gc p99 %.2fms ",
+		(st_cnt[ST_READ] - st_lcnt[ST_READ]) / MAX(sec, 1e-3) / 1024,
+		(st_cnt[ST_FLUSH] - st_lcnt[ST_FLUSH]) / MAX(sec, 1e-3),
+		st_hits(), st_pct(99) * nspt / 1e6);
+	memcpy(st_lcnt, st_cnt, sizeof(st_lcnt));
+	st_ltick = t;
+	return st_buf;
+}
+
+/* write the statistics since st_init() to path */
+int st_dump(char *path)
+{
+	double nspt = st_nspt();
+	FILE *fp;
+	int i;
+	if (!(fp = fopen(path, "w")))
+		return 1;
+	fprintf(fp, "%-12s %12s %12s %10s\n", "path", "count", "msec", "ns/op");
+	for (i = 0; i < ST_N; i++)
+		fprintf(fp, "%-12s %12lu %12.1f %10.1f\n", st_names[i], st_cnt[i],
+			st_tm[i] * nspt / 1e6, st_tm[i] * nspt / MAX(1, st_cnt[i]));
+	fprintf(fp, "glyph cache hits: %.1f%%\n", st_hits());
+	fprintf(fp, "frame msec: p50 %.2f p99 %.2f max %.2f\n",
+		st_pct(50) * nspt / 1e6, st_pct(99) * nspt / 1e6,
+		st_pct(100) * nspt / 1e6);
+	fclose(fp);
+	return 0;
+}
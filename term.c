@@ -8,6 +8,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
 #include "conf.h"
@@ -33,10 +34,13 @@
 #define CLR_I			FN_I
 #define FG			0x100
 #define BG			0x101
+#define CLR_CUR			0x10000000	/* drawn as the cursor */
 
 #define LIMIT(n, a, b)		((n) < (a) ? (a) : ((n) > (b) ? (b) : (n)))
 #define BIT_SET(i, b, val)	((val) ? ((i) | (b)) : ((i) & ~(b)))
-#define OFFSET(r, c)		((r) * pad_cols() + (c))
+#define OFFSET(r, c)		(term->rmap[r] * bufcols + (c))	/* screen and clr */
+#define POFF(r, c)		((r) * bufcols + (c))		/* pscreen and pclr */
+#define SENDLEN			(1 << 12)
 
 struct term_state {
 	int row, col;
@@ -46,30 +50,36 @@ struct term_state {
 
 struct term {
 	int *screen;			/* screen content */
-	int *hist;			/* scrolling history */
+	struct hchunk *hhead, *htail;	/* history chunks; the oldest and the newest */
+	int **hline;			/* history lines in a ring of hsz entries */
+	int hsz;			/* the size of hline[] */
+	int hbeg, hcnt;			/* the oldest history line and history length */
 	int *clr;			/* foreground/background color */
 	int *dirty;			/* changed rows in lazy mode */
-	struct term_state cur, sav;	/* terminal saved state */
+	int *pscreen, *pclr;		/* screen and clr as drawn */
+	int *rmap;			/* the rows of screen and clr shown in each row */
+	int proff, pcoff;		/* the position of the pad it was drawn on */
+	int capid;			/* the terminal in capture logs or -1 */
+	int row, col;			/* cursor position */
+	int fg, bg;			/* current colors */
+	int mode;			/* terminal modes and attributes */
+	struct term_state sav;		/* terminal saved state */
 	int fd;				/* terminal file descriptor */
-	int hrow;			/* the next history row in hist[] */
 	int hpos;			/* scrolling history; position */
 	int lazy;			/* lazy mode */
+	int psr, per, pn;		/* lazy mode: rows psr to per scrolled by pn */
 	int pid;			/* pid of the terminal program */
 	int top, bot;			/* terminal scrolling region */
 	int rows, cols;
 	int signal;			/* send SIGUSR1 and SIGUSR2 */
+	char sbuf[SENDLEN];		/* bytes to write to fd */
+	int slen;			/* the length of sbuf[] */
 };
 
-static struct term *term;
-static int *screen;
-static int *clr;
-static int *dirty;
-static int lazy;
-static int row, col;
-static int fg, bg;
-static int top, bot;
-static int mode;
+static struct term *term;	/* the terminal being updated */
 static int visible;
+static int bufcols, bufrows;	/* the size of terminal buffers */
+static int nhist = NHIST;
 static int clrfg = FGCOLOR;
 static int clrbg = BGCOLOR;
 
@@ -78,7 +88,8 @@ static unsigned int clr16[16] = {
 	COLOR8, COLOR9, COLORA, COLORB, COLORC, COLORD, COLORE, COLORF,
 };
 
-static int clrmap(int c)
+/* the RGB value of colour c */
+static int clrrgb(int c)
 {
 	int g = (c - 232) * 10 + 8;
 	if (c < 16)
@@ -99,14 +110,33 @@ static int clrmap(int c)
 	return (g << 16) | (g << 8) | g;
 }
 
+/* colours 0-255, FG, BG, and the rest of CLR_FG() values */
+#define NCLR		0x400
+
+/* give the RGB values of colours to pad.c, which converts them once */
+static void clr_load(void)
+{
+	int pal[NCLR];
+	int i;
+	for (i = 0; i < NCLR; i++)
+		pal[i] = clrrgb(i);
+	pad_palette(pal, NCLR);
+}
+
+/* colour c for pad_put() and pad_fill(); an index into the palette */
+static int clrmap(int c)
+{
+	return FN_P | c;
+}
+
 /* low level drawing and lazy updating */
 
 static int color(void)
 {
-	int c = mode & ATTR_REV ? CLR_MK(bg, fg) : CLR_MK(fg, bg);
-	if (mode & ATTR_BOLD)
+	int c = term->mode & ATTR_REV ? CLR_MK(term->bg, term->fg) : CLR_MK(term->fg, term->bg);
+	if (term->mode & ATTR_BOLD)
 		c |= CLR_B;
-	if (mode & ATTR_ITALIC)
+	if (term->mode & ATTR_ITALIC)
 		c |= CLR_I;
 	return c;
 }
@@ -114,44 +144,108 @@ static int color(void)
 /* assumes visible && !lazy */
 static void _draw_pos(int r, int c, int cursor)
 {
-	int rev = cursor && mode & MODE_CURSOR;
+	int rev = cursor && term->mode & MODE_CURSOR;
 	int i = OFFSET(r, c);
-	int fg = rev ? CLR_BG(clr[i]) : CLR_FG(clr[i]);
-	int bg = rev ? CLR_FG(clr[i]) : CLR_BG(clr[i]);
-	pad_put(screen[i], r, c, CLR_M(clr[i]) | clrmap(fg), clrmap(bg));
+	int p = POFF(r, c);
+	int f = rev ? CLR_BG(term->clr[i]) : CLR_FG(term->clr[i]);
+	int b = rev ? CLR_FG(term->clr[i]) : CLR_BG(term->clr[i]);
+	pad_put(term->screen[i], r, c, CLR_M(term->clr[i]) | clrmap(f), clrmap(b));
+	term->pscreen[p] = term->screen[i];
+	term->pclr[p] = rev ? term->clr[i] | CLR_CUR : term->clr[i];
 }
 
-/* assumes visible && !lazy */
-static void _draw_row(int r)
+/* assumes visible && !lazy; draw the cells of row r that have changed */
+static void _draw_row(int r, int cursor)
 {
-	int cbg, cch;		/* current background and character */
-	int fbg, fsc = -1;	/* filling background and start column */
-	int i;
+	int cbg = 0, cch;	/* current background and character */
+	int fbg = 0, fsc = -1;	/* filling background and start column */
+	int cur, same = 1;	/* the cursor is drawn here, the cell is unchanged */
+	int i, o, p;
 	/* call pad_fill() only once for blank columns with identical backgrounds */
 	for (i = 0; i < pad_cols(); i++) {
-		cbg = CLR_BG(clr[OFFSET(r, i)]);
-		cch = screen[OFFSET(r, i)] ? screen[OFFSET(r, i)] : ' ';
-		if (fsc >= 0 && (cbg != fbg || cch != ' ')) {
+		o = OFFSET(r, i);
+		p = POFF(r, i);
+		cbg = CLR_BG(term->clr[o]);
+		cch = term->screen[o] ? term->screen[o] : ' ';
+		cur = cursor && r == term->row && i == term->col && term->mode & MODE_CURSOR;
+		same = term->pscreen[p] == term->screen[o] && term->pclr[p] == (cur ? term->clr[o] | CLR_CUR : term->clr[o]);
+		if (fsc >= 0 && (same || cur || cbg != fbg || cch != ' ')) {
 			pad_fill(r, r + 1, fsc, i, clrmap(fbg));
 			fsc = -1;
 		}
-		if (cch != ' ') {
-			_draw_pos(r, i, 0);
-		} else if (fsc < 0) {
-			fsc = i;
-			fbg = cbg;
+		if (same)
+			continue;
+		if (cch != ' ' || cur) {
+			_draw_pos(r, i, cur);
+		} else {
+			if (fsc < 0) {
+				fsc = i;
+				fbg = cbg;
+			}
+			term->pscreen[p] = term->screen[o];
+			term->pclr[p] = term->clr[o];
 		}
 	}
-	pad_fill(r, r + 1, fsc >= 0 ? fsc : pad_cols(), -1, clrmap(cbg));
+	if (fsc >= 0 || !same)
+		pad_fill(r, r + 1, fsc >= 0 ? fsc : pad_cols(), -1, clrmap(cbg));
 }
 
 static int candraw(int sr, int er)
 {
 	int i;
-	if (lazy)
+	if (term->lazy)
 		for (i = sr; i < er; i++)
-			dirty[i] = 1;
-	return visible && !lazy;
+			term->dirty[i] = 1;
+	return visible && !term->lazy;
+}
+
+/* some cells of row r were not drawn or were drawn over, like the status bar */
+static int drawn_lost(int r)
+{
+	int i;
+	for (i = 0; i < pad_cols(); i++)
+		if (term->pclr[POFF(r, i)] == -1)
+			return 1;
+	return 0;
+}
+
+/* assumes visible; move the pixels of rows sr to er by n rows */
+static void _draw_scroll(int sr, int er, int n)
+{
+	int i;
+	pad_scroll(sr, er, n);
+	memmove(term->pscreen + POFF(sr + n, 0), term->pscreen + POFF(sr, 0),
+		(er - sr) * bufcols * sizeof(*term->pscreen));
+	memmove(term->pclr + POFF(sr + n, 0), term->pclr + POFF(sr, 0),
+		(er - sr) * bufcols * sizeof(*term->pclr));
+	/* the pixels of such rows are redrawn wherever they were moved */
+	for (i = sr + n; i < er + n; i++)
+		if (drawn_lost(i) && candraw(i, i + 1))
+			_draw_row(i, 0);
+}
+
+/* forget the drawn contents of rows sr to er; they are redrawn completely */
+static void drawn_reset(int sr, int er)
+{
+	memset(term->pclr + POFF(sr, 0), 0xff, (er - sr) * bufcols * sizeof(*term->pclr));
+}
+
+/* move the pixels of kr rows and kc columns, from row dr of the pad it was drawn on */
+static void drawn_move(int dr, int kr, int kc)
+{
+	int ec = MIN(kc, pad_cols() - 1);
+	int i;
+	pad_blit(term->proff, term->pcoff, dr, kr, kc);
+	if (dr) {
+		memmove(term->pscreen, term->pscreen + POFF(dr, 0),
+			kr * bufcols * sizeof(*term->pscreen));
+		memmove(term->pclr, term->pclr + POFF(dr, 0),
+			kr * bufcols * sizeof(*term->pclr));
+	}
+	drawn_reset(kr, pad_rows());
+	/* the new columns; the last column fills the right margin */
+	for (i = 0; i < kr; i++)
+		memset(term->pclr + POFF(i, ec), 0xff, (pad_cols() - ec) * sizeof(*term->pclr));
 }
 
 static void draw_rows(int sr, int er)
@@ -159,7 +253,7 @@ static void draw_rows(int sr, int er)
 	int i;
 	if (candraw(sr, er))
 		for (i = sr; i < er; i++)
-			_draw_row(i);
+			_draw_row(i, 0);
 }
 
 static void draw_cols(int r, int sc, int ec)
@@ -173,63 +267,99 @@ static void draw_cols(int r, int sc, int ec)
 static void draw_char(int ch, int r, int c)
 {
 	int i = OFFSET(r, c);
-	screen[i] = ch;
-	clr[i] = color();
+	term->screen[i] = ch;
+	term->clr[i] = color();
 	if (candraw(r, r + 1))
 		_draw_pos(r, c, 0);
 }
 
 static void draw_cursor(int put)
 {
-	if (candraw(row, row + 1))
-		_draw_pos(row, col, put);
+	if (candraw(term->row, term->row + 1))
+		_draw_pos(term->row, term->col, put);
 }
 
 static void lazy_start(void)
 {
-	memset(dirty, 0, pad_rows() * sizeof(*dirty));
-	lazy = 1;
+	memset(term->dirty, 0, term->rows * sizeof(*term->dirty));
+	term->pn = 0;
+	term->lazy = 1;
+}
+
+/* move the pixels of the rows scrolled in lazy mode, unless all are dirty */
+static void lazy_scroll(void)
+{
+	int n = term->pn;
+	int sr = n > 0 ? term->psr + n : term->psr;
+	int er = n > 0 ? term->per : term->per + n;
+	int i;
+	term->pn = 0;
+	for (i = sr; i < er; i++)
+		if (!term->dirty[i])
+			break;
+	if (i < er)
+		_draw_scroll(sr - n, er - n, n);
 }
 
 static void lazy_flush(void)
 {
 	int i;
-	if (!visible || !lazy)
+	if (!visible || !term->lazy)
 		return;
-	for (i = 0; i < pad_rows(); i++)
-		if (dirty[i])
-			_draw_row(i);
-	if (dirty[row])
-		_draw_pos(row, col, 1);
-	lazy = 0;
+	ST_START(t);
+	if (term->pn)
+		lazy_scroll();
+	for (i = 0; i < term->rows; i++)
+		if (term->dirty[i])
+			_draw_row(i, 1);
+	term->lazy = 0;
 	term->hpos = 0;
+	ST_STOP(ST_FLUSH, t, 1);
 }
 
-static void screen_reset(int i, int n)
+/* clear n cells of row r, starting from column c */
+static void screen_reset(int r, int c, int n)
 {
-	int c;
-	candraw(i / pad_cols(), (i + n) / pad_cols());
-	memset(screen + i, 0, n * sizeof(*screen));
+	int i = OFFSET(r, c);
+	candraw(r, r + 1);
+	memset(term->screen + i, 0, n * sizeof(*term->screen));
 	for (c = 0; c < n; c++)
-		clr[i + c] = CLR_MK(fg, bg);
+		term->clr[i + c] = CLR_MK(term->fg, term->bg);
+}
+
+/* move n cells of row r from column sc to column dc */
+static void screen_move(int r, int dc, int sc, int n)
+{
+	candraw(r, r + 1);
+	memmove(term->screen + OFFSET(r, dc), term->screen + OFFSET(r, sc), n * sizeof(*term->screen));
+	memmove(term->clr + OFFSET(r, dc), term->clr + OFFSET(r, sc), n * sizeof(*term->clr));
 }
 
-static void screen_move(int dst, int src, int n)
+/* rotate rows sr to er of rmap up by n */
+static void rmap_rotate(int sr, int er, int n)
 {
-	int srow = (MIN(src, dst) + (n > 0 ? 0 : n)) / pad_cols();
-	int drow = (MAX(src, dst) + (n > 0 ? n : 0)) / pad_cols();
-	candraw(srow, drow);
-	memmove(screen + dst, screen + src, n * sizeof(*screen));
-	memmove(clr + dst, clr + src, n * sizeof(*clr));
+	int i, j, k;
+	int *m = term->rmap;
+	for (k = 0; k < 3; k++) {	/* by reversing the two parts and the whole */
+		int s = k == 1 ? sr + n : sr;
+		int e = k == 0 ? sr + n : er;
+		for (i = s, j = e - 1; i < j; i++, j--) {
+			int t = m[i];
+			m[i] = m[j];
+			m[j] = t;
+		}
+	}
 }
 
 /* terminal input buffering */
 
 #define PTYLEN			(1 << 16)
 
-static char ptybuf[PTYLEN];		/* always emptied in term_read() */
+static char ptymem[PTYLEN];
+static char *ptybuf = ptymem;		/* always emptied in term_read() */
 static int ptylen;			/* buffer length */
 static int ptycur;			/* current offset */
+static int ptymax = PTYLEN;		/* the number of bytes to read */
 
 static int waitpty(int us)
 {
@@ -244,56 +374,229 @@ static int readpty(void)
 	int nr;
 	if (ptycur < ptylen)
 		return (unsigned char) ptybuf[ptycur++];
-	if (!term->fd)
+	if (!term->fd || ptybuf != ptymem)	/* the end of term_feed() bytes */
 		return -1;
 	ptylen = 0;
-	while ((nr = read(term->fd, ptybuf + ptylen, PTYLEN - ptylen)) > 0)
+	while ((nr = read(term->fd, ptybuf + ptylen, ptymax - ptylen)) > 0)
 		ptylen += nr;
 	if (!ptylen && errno == EAGAIN && !waitpty(100))
-		ptylen = read(term->fd, ptybuf, PTYLEN);
+		ptylen = read(term->fd, ptybuf, ptymax);
+	ST_ADD(ST_READ, MAX(0, ptylen));
+	if (ptylen > 0 && term->capid >= 0)
+		cap_put(term->capid, ptybuf, ptylen);
 	ptycur = 1;
 	return ptylen > 0 ? (unsigned char) ptybuf[0] : -1;
 }
 
+/* scrolling history */
+
+#define HCHUNK		((1 << 14) - 8)	/* the size of history chunks; 64KB with headers */
+
+/*
+ * History lines are appended to chunks of HCHUNK ints.  Each line
+ * is stored as n, its width, the character and color of its last
+ * cell, followed by the characters and the colors of its first n
+ * cells; the cells after them equal the last cell.
+ */
+struct hchunk {
+	struct hchunk *next;
+	int len;		/* the number of used ints */
+	int lines;		/* the number of lines stored in this chunk */
+	int buf[HCHUNK];
+};
+
+static void hist_free(struct term *term)
+{
+	while (term->hhead) {
+		struct hchunk *next = term->hhead->next;
+		pool_put(term->hhead);
+		term->hhead = next;
+	}
+	free(term->hline);
+	term->htail = NULL;
+	term->hline = NULL;
+	term->hsz = 0;
+	term->hbeg = 0;
+	term->hcnt = 0;
+}
+
+/* make room for one more line in hline[]; return nonzero on failure */
+static int hist_grow(void)
+{
+	int **hline;
+	int sz = MIN(nhist, MAX(64, term->hsz * 2));
+	int i;
+	if (term->hcnt < term->hsz || term->hsz >= nhist)
+		return 0;
+	if (!(hline = malloc(sz * sizeof(hline[0]))))
+		return 1;
+	for (i = 0; i < term->hcnt; i++)
+		hline[i] = term->hline[(term->hbeg + i) % term->hsz];
+	free(term->hline);
+	term->hline = hline;
+	term->hsz = sz;
+	term->hbeg = 0;
+	return 0;
+}
+
+/* the address of n ints for a new history line */
+static int *hist_alloc(int n)
+{
+	struct hchunk *c = term->htail;
+	if (n > HCHUNK)
+		return NULL;
+	if (!c || c->len + n > HCHUNK) {
+		if (!(c = pool_get(sizeof(*c))))
+			return NULL;
+		c->next = NULL;
+		c->len = 0;
+		c->lines = 0;
+		if (term->htail)
+			term->htail->next = c;
+		else
+			term->hhead = c;
+		term->htail = c;
+	}
+	c->len += n;
+	c->lines++;
+	return c->buf + c->len - n;
+}
+
+/* drop the oldest history line */
+static void hist_drop(void)
+{
+	struct hchunk *c = term->hhead;
+	term->hbeg = (term->hbeg + 1) % term->hsz;
+	term->hcnt--;
+	if (!--c->lines) {
+		term->hhead = c->next;
+		if (term->htail == c)
+			term->htail = NULL;
+		pool_put(c);
+	}
+}
+
+/* append w cells of screen and clr to the history */
+static void hist_push(int *s, int *c, int w)
+{
+	int *ln;
+	int n = w - 1;
+	if (nhist <= 0 || w <= 0)
+		return;
+	while (n > 0 && s[n - 1] == s[w - 1] && c[n - 1] == c[w - 1])
+		n--;
+	while (term->hcnt && term->hcnt >= nhist)
+		hist_drop();
+	if (hist_grow() || term->hcnt == term->hsz || !(ln = hist_alloc(4 + 2 * n)))
+		return;
+	ln[0] = n;
+	ln[1] = w;
+	ln[2] = s[w - 1];
+	ln[3] = c[w - 1];
+	memcpy(ln + 4, s, n * sizeof(ln[0]));
+	memcpy(ln + 4 + n, c, n * sizeof(ln[0]));
+	term->hline[(term->hbeg + term->hcnt++) % term->hsz] = ln;
+}
+
+/* the character and color of cell c of history line pos (one is the last line) */
+static int hist_cell(int pos, int c, int *cl)
+{
+	int *ln = term->hline[(term->hbeg + term->hcnt - pos) % term->hsz];
+	if (c >= ln[1]) {
+		*cl = CLR_MK(FG, BG);
+		return 0;
+	}
+	*cl = c < ln[0] ? ln[4 + ln[0] + c] : ln[3];
+	return c < ln[0] ? ln[4 + c] : ln[2];
+}
+
 /* term interface functions */
 
+/* set the number of history lines of terminals */
+void term_histsize(int n)
+{
+	nhist = MAX(0, n);
+}
+
+/*
+ * Allocate screen, clr, pscreen, pclr, dirty, and rmap of term in one
+ * buffer.  Rows are bufcols cells apart, so that the columns of the
+ * terminal can change without moving cells.
+ */
+static int term_alloc(struct term *term)
+{
+	int bufcells = bufrows * bufcols;
+	int *buf = pool_get((4 * bufcells + 2 * bufrows) * sizeof(buf[0]));
+	int i;
+	if (!buf)
+		return 1;
+	term->screen = buf;
+	term->clr = buf + bufcells;
+	term->pscreen = buf + 2 * bufcells;
+	term->pclr = buf + 3 * bufcells;
+	term->dirty = buf + 4 * bufcells;
+	term->rmap = buf + 4 * bufcells + bufrows;
+	memset(term->screen, 0, bufcells * sizeof(term->screen[0]));
+	memset(term->clr, 0, bufcells * sizeof(term->clr[0]));
+	memset(term->pscreen, 0, bufcells * sizeof(term->pscreen[0]));
+	memset(term->pclr, 0xff, bufcells * sizeof(term->pclr[0]));
+	memset(term->dirty, 0, bufrows * sizeof(term->dirty[0]));
+	for (i = 0; i < bufrows; i++)
+		term->rmap[i] = i;
+	return 0;
+}
+
+static void term_release(struct term *term)
+{
+	pool_put(term->screen);
+	term->screen = NULL;
+	term->clr = NULL;
+	term->pscreen = NULL;
+	term->pclr = NULL;
+	term->dirty = NULL;
+	term->rmap = NULL;
+}
+
 static void term_zero(struct term *term)
 {
-	memset(term->screen, 0, pad_rows() * pad_cols() * sizeof(term->screen[0]));
-	memset(term->hist, 0, NHIST * pad_cols() * sizeof(term->hist[0]));
-	memset(term->clr, 0, pad_rows() * pad_cols() * sizeof(term->clr[0]));
-	memset(term->dirty, 0, pad_rows() * sizeof(term->dirty[0]));
-	memset(&term->cur, 0, sizeof(term->cur));
+	term_release(term);
+	hist_free(term);
 	memset(&term->sav, 0, sizeof(term->sav));
+	term->row = 0;
+	term->col = 0;
+	term->fg = 0;
+	term->bg = 0;
+	term->mode = 0;
 	term->fd = 0;
-	term->hrow = 0;
 	term->hpos = 0;
 	term->lazy = 0;
+	term->pn = 0;
 	term->pid = 0;
 	term->top = 0;
 	term->bot = 0;
 	term->rows = 0;
 	term->cols = 0;
+	term->proff = 0;
+	term->pcoff = 0;
 	term->signal = 0;
+	term->slen = 0;
 }
 
+/* terminal buffers are allocated in term_exec(), for the largest pad so far */
 struct term *term_make(void)
 {
-	struct term *term = malloc(sizeof(*term));
-	term->screen = malloc(pad_rows() * pad_cols() * sizeof(term->screen[0]));
-	term->hist = malloc(NHIST * pad_cols() * sizeof(term->hist[0]));
-	term->clr = malloc(pad_rows() * pad_cols() * sizeof(term->clr[0]));
-	term->dirty = malloc(pad_rows() * sizeof(term->dirty[0]));
-	term_zero(term);
+	struct term *term = calloc(1, sizeof(*term));
+	if (term)
+		term->capid = -1;
+	clr_load();
+	bufcols = MAX(bufcols, pad_cols());
+	bufrows = MAX(bufrows, pad_rows());
 	return term;
 }
 
 void term_free(struct term *term)
 {
-	free(term->screen);
-	free(term->hist);
-	free(term->clr);
-	free(term->dirty);
+	term_zero(term);
 	free(term);
 }
 
@@ -302,46 +605,110 @@ int term_fd(struct term *term)
 	return term->fd;
 }
 
+/* write the queued bytes; return the number of bytes left in the queue */
+int term_sendq(struct term *term)
+{
+	int nw = term->fd && term->slen ? write(term->fd, term->sbuf, term->slen) : 0;
+	if (nw > 0) {
+		memmove(term->sbuf, term->sbuf + nw, term->slen - nw);
+		term->slen -= nw;
+	}
+	return term->slen;
+}
+
+/* queue n bytes to be written in term_sendq(); dropped if it is full */
+static void term_sendbuf(char *s, int n)
+{
+	if (term->fd && term->slen + n > SENDLEN)
+		term_sendq(term);
+	if (term->fd && term->slen + n <= SENDLEN) {
+		memcpy(term->sbuf + term->slen, s, n);
+		term->slen += n;
+	}
+}
+
 void term_send(int c)
 {
 	char b = c;
-	if (term->fd)
-		write(term->fd, &b, 1);
+	term_sendbuf(&b, 1);
 }
 
 static void term_sendstr(char *s)
 {
-	if (term->fd)
-		write(term->fd, s, strlen(s));
+	term_sendbuf(s, strlen(s));
 }
 
+static void empty_rows(int sr, int er);
+
 static void term_blank(void)
 {
-	screen_reset(0, pad_rows() * pad_cols());
+	empty_rows(0, term->rows);
 	if (visible)
 		pad_fill(0, -1, 0, -1, clrmap(CLR_BG(color())));
 }
 
 static void ctlseq(void);
+/* read terminal output; the changes are drawn in term_flush() */
 void term_read(void)
 {
+	ST_START(t);
+	if (visible && !term->lazy)
+		lazy_start();
 	ctlseq();
-	while (ptycur < ptylen) {
-		if (visible && !lazy && ptylen - ptycur > 15)
-			lazy_start();
+	while (ptycur < ptylen)
 		ctlseq();
-	}
+	ST_STOP(ST_READ, t, 0);
+}
+
+/*
+ * parse the output of the loaded terminal in s, for benchmarks: the
+ * sequences starting in its first n bytes, which may continue up to
+ * its len-th byte; returns the number of bytes parsed.
+ */
+int term_feed(char *s, int n, int len)
+{
+	if (visible && !term->lazy)
+		lazy_start();
+	ptybuf = s;
+	ptylen = len;
+	ptycur = 0;
+	while (ptycur < n)
+		ctlseq();
+	n = ptycur;
+	ptybuf = ptymem;
+	ptylen = 0;
+	ptycur = 0;
+	return n;
+}
+
+/* read at most max bytes of the output of t, which need not be loaded */
+void term_readbg(struct term *t, int max)
+{
+	struct term *o = term;
+	int v = visible;
+	term = t;
+	visible = 0;
+	ptymax = MIN(max, PTYLEN);
+	term_read();
+	ptymax = PTYLEN;
+	term = o;
+	visible = v;
+}
+
+/* draw the changes of the loaded terminal */
+void term_flush(void)
+{
 	lazy_flush();
 }
 
 static void term_reset(void)
 {
-	row = col = 0;
-	top = 0;
-	bot = pad_rows();
-	mode = MODE_CURSOR | MODE_WRAP | MODE_CLR8;
-	fg = FG;
-	bg = BG;
+	term->row = term->col = 0;
+	term->top = 0;
+	term->bot = term->rows;
+	term->mode = MODE_CURSOR | MODE_WRAP | MODE_CLR8;
+	term->fg = FG;
+	term->bg = BG;
 	term_blank();
 }
 
@@ -419,22 +786,43 @@ static void envset(char **d, char *env)
 	d[i] = env;
 }
 
+static void envdel(char **d, char *env)
+{
+	int i, j;
+	for (i = 0, j = 0; d[i]; i++)
+		if (strncmp(d[i], env, strlen(env)))
+			d[j++] = d[i];
+	d[j] = NULL;
+}
+
 extern char **environ;
 void term_exec(char **args, int swsig)
 {
 	int master, slave;
 	term_zero(term);
-	if (_openpty(&master, &slave) == -1)
+	if (term_alloc(term))
+		return;
+	if (_openpty(&master, &slave) == -1) {
+		term_release(term);
 		return;
-	if ((term->pid = fork()) == -1)
+	}
+	if ((term->pid = fork()) == -1) {
+		term_release(term);
 		return;
+	}
 	if (!term->pid) {
 		char *envp[256] = {NULL};
 		char pgid[32];
+		sigset_t set;
+		sigemptyset(&set);
+		sigprocmask(SIG_SETMASK, &set, NULL);	/* fbpad blocks some signals */
 		snprintf(pgid, sizeof(pgid), "TERM_PGID=%d", getpid());
 		envcpy(envp, environ, LEN(envp) - 3);
 		envset(envp, "TERM=" TERM);
-		envset(envp, pad_fbdev());
+		if (pad_fbdev())
+			envset(envp, pad_fbdev());
+		else
+			envdel(envp, "FBDEV=");
 		if (swsig)
 			envset(envp, pgid);
 		tio_login(slave);
@@ -450,36 +838,32 @@ void term_exec(char **args, int swsig)
 	fcntl(term->fd, F_SETFD, fcntl(term->fd, F_GETFD) | FD_CLOEXEC);
 	fcntl(term->fd, F_SETFL, fcntl(term->fd, F_GETFL) | O_NONBLOCK);
 	term_reset();
-	memset(term->hist, 0, NHIST * pad_cols() * sizeof(term->hist[0]));
 }
 
 static void misc_save(struct term_state *state)
 {
-	state->row = row;
-	state->col = col;
-	state->fg = fg;
-	state->bg = bg;
-	state->mode = mode;
+	state->row = term->row;
+	state->col = term->col;
+	state->fg = term->fg;
+	state->bg = term->bg;
+	state->mode = term->mode;
 }
 
 static void misc_load(struct term_state *state)
 {
-	row = state->row;
-	col = state->col;
-	fg = state->fg;
-	bg = state->bg;
-	mode = state->mode;
+	term->row = state->row;
+	term->col = state->col;
+	term->fg = state->fg;
+	term->bg = state->bg;
+	term->mode = state->mode;
 }
 
-void term_save(struct term *term)
+void term_save(struct term *t)
 {
+	term = t;
 	visible = 0;
-	if (!lazy)
+	if (!term->lazy && term->dirty)
 		lazy_start();
-	misc_save(&term->cur);
-	term->top = top;
-	term->bot = bot;
-	term->lazy = lazy;
 }
 
 void term_hide(struct term *term)
@@ -499,40 +883,57 @@ void term_signal(struct term *term)
 	term->signal = 1;
 }
 
-static void resizeupdate(int or, int oc, int nr,  int nc)
+/* change the size of the screen; return the number of rows dropped from the top */
+static int resizeupdate(int or, int oc, int nr, int nc)
 {
-	int dr = row >= nr ? row - nr + 1 : 0;
-	int dst = nc <= oc ? 0 : nr * nc - 1;
-	while (dst >= 0 && dst < nr * nc) {
-		int r = dst / nc;
-		int c = dst % nc;
-		int src = dr + r < or && c < oc ? (dr + r) * oc + c : -1;
-		term->screen[dst] = src >= 0 ? term->screen[src] : 0;
-		term->clr[dst] = src >= 0 ? term->clr[src] : color();
-		dst = nc <= oc ? dst + 1 : dst - 1;
+	int dr = term->row >= nr ? term->row - nr + 1 : 0;
+	int i, j;
+	if (dr)
+		rmap_rotate(0, bufrows, dr);
+	for (i = 0; i < nr; i++) {
+		for (j = i < or - dr ? oc : 0; j < nc; j++) {
+			term->screen[OFFSET(i, j)] = 0;
+			term->clr[OFFSET(i, j)] = color();
+		}
 	}
+	return dr;
 }
 
-/* redraw the screen; if all is zero, update changed lines only */
+/*
+ * Redraw the screen; if all is zero, update changed lines only.  If
+ * all is two, the pixels of the terminal drawn on its previous pad
+ * are moved and only the rest is drawn.
+ */
 void term_redraw(int all)
 {
 	if (term->fd) {
+		int kr = term->rows, kc = term->cols;	/* rows and columns kept */
+		int dr = 0;
 		if (term->rows != pad_rows() || term->cols != pad_cols()) {
 			tio_setsize(term->fd);
-			resizeupdate(term->rows, term->cols, pad_rows(), pad_cols());
-			if (bot == term->rows)
-				bot = pad_rows();
+			dr = resizeupdate(term->rows, term->cols, pad_rows(), pad_cols());
+			term->pn = 0;
+			if (term->bot == term->rows)
+				term->bot = pad_rows();
 			term->rows = pad_rows();
 			term->cols = pad_cols();
-			top = MIN(top, term->rows);
-			bot = MIN(bot, term->rows);
-			row = MIN(row, term->rows - 1);
-			col = MIN(col, term->cols - 1);
+			term->top = MIN(term->top, term->rows);
+			term->bot = MIN(term->bot, term->rows);
+			term->row = MIN(term->row, term->rows - 1);
+			term->col = MIN(term->col, term->cols - 1);
+			kr = MIN(kr - dr, term->rows);
+			kc = MIN(kc, term->cols);
 		}
+		if (all == 2)
+			drawn_move(dr, kr, kc);
+		else
+			drawn_reset(0, pad_rows());
+		term->proff = pad_roff();
+		term->pcoff = pad_coff();
 		if (all) {
 			pad_fill(pad_rows(), -1, 0, -1, clrbg);
 			lazy_start();
-			memset(dirty, 1, pad_rows() * sizeof(*dirty));
+			memset(term->dirty, 1, pad_rows() * sizeof(*term->dirty));
 		}
 		if (all || !term->hpos)
 			lazy_flush();
@@ -542,17 +943,35 @@ void term_redraw(int all)
 	}
 }
 
+/* rows sr to er of the loaded terminal were drawn over */
+void term_overdraw(int sr, int er)
+{
+	if (term && term->pclr)
+		drawn_reset(sr, er);
+}
+
+/* record the output of t as terminal id in capture logs */
+void term_capture(struct term *t, int id)
+{
+	t->capid = id;
+}
+
+/* nothing was drawn on row r of the loaded terminal since term_overdraw() */
+int term_overdrawn(int r)
+{
+	int i;
+	if (!term || !term->pclr)
+		return 0;
+	for (i = 0; i < pad_cols(); i++)
+		if (term->pclr[POFF(r, i)] != -1)
+			return 0;
+	return 1;
+}
+
 void term_load(struct term *t, int flags)
 {
 	term = t;
-	misc_load(&term->cur);
-	screen = term->screen;
-	clr = term->clr;
 	visible = flags;
-	top = term->top;
-	bot = term->bot;
-	lazy = term->lazy;
-	dirty = term->dirty;
 }
 
 void term_end(void)
@@ -590,30 +1009,133 @@ static int writeutf8(char *dst, int c)
 	return 4;
 }
 
-void term_screenshot(const char *path, int a)
+/* screenshots */
+
+#define SHOTLEN		(1 << 16)	/* the size of screenshot writes */
+
+static char shotbuf[SHOTLEN];
+static int shotlen;
+
+static void shot_flush(int fd)
+{
+	char *s = shotbuf;
+	while (shotlen > 0) {
+		int n = write(fd, s, shotlen);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		s += n;
+		shotlen -= n;
+	}
+	shotlen = 0;
+}
+
+/* the SGR parameters of colour c, unless it is the default of SGR 38 or 48 */
+static int shot_clr(char *s, int sgr, int c)
+{
+	int rgb = clrrgb(c);
+	if (c == (sgr == 38 ? FG : BG))
+		return 0;
+	if (c < 256)
+		return sprintf(s, ";%d;5;%d", sgr, c);
+	return sprintf(s, ";%d;2;%d;%d;%d", sgr, rgb >> 16, (rgb >> 8) & 0xff, rgb & 0xff);
+}
+
+/* append cell ch with colour c; lc is the colour of the previous cell */
+static void shot_cell(int fd, int ch, int c, int *lc)
+{
+	if (shotlen + 64 > SHOTLEN)
+		shot_flush(fd);
+	if (SCRANSI && c != *lc) {
+		char *s = shotbuf + shotlen;
+		s += sprintf(s, "\x1b[0%s%s", c & CLR_B ? ";1" : "", c & CLR_I ? ";3" : "");
+		s += shot_clr(s, 38, CLR_FG(c));
+		s += shot_clr(s, 48, CLR_BG(c));
+		*s++ = 'm';
+		shotlen = s - shotbuf;
+		*lc = c;
+	}
+	if (~ch & DWCHAR)
+		shotlen += writeutf8(shotbuf + shotlen, ch);
+}
+
+static void shot_eol(int fd, int *lc)
+{
+	if (shotlen + 64 > SHOTLEN)
+		shot_flush(fd);
+	if (SCRANSI && *lc != CLR_MK(FG, BG)) {
+		shotlen += sprintf(shotbuf + shotlen, "\x1b[0m");
+		*lc = CLR_MK(FG, BG);
+	}
+	shotbuf[shotlen++] = '\n';
+}
+
+static void shot_write(int fd, int a)
 {
-	char buf[1 << 11];
-	int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+	int lc = CLR_MK(FG, BG);
 	int i, j;
-	if (a) {
-		for (i = 0; i < NHIST; i++) {
-			char *t = buf;
-			for (j = 0; j < pad_cols(); j++)
-				if (~(term->hist)[OFFSET(i, j)] & DWCHAR)
-					t += writeutf8(t, (term->hist)[OFFSET(i, j)]);
-			*t++ = '\n';
-			write(fd, buf, t - buf);
+	for (i = a ? term->hcnt : 0; i > 0; i--) {
+		for (j = 0; j < term->cols; j++) {
+			int c, ch = hist_cell(i, j, &c);
+			shot_cell(fd, ch, c, &lc);
 		}
+		shot_eol(fd, &lc);
 	}
-	for (i = 0; i < pad_rows(); i++) {
-		char *s = buf;
-		for (j = 0; j < pad_cols(); j++)
-			if (~screen[OFFSET(i, j)] & DWCHAR)
-				s += writeutf8(s, screen[OFFSET(i, j)]);
-		*s++ = '\n';
-		write(fd, buf, s - buf);
+	for (i = 0; term->screen && i < term->rows; i++) {
+		for (j = 0; j < term->cols; j++)
+			shot_cell(fd, term->screen[OFFSET(i, j)], term->clr[OFFSET(i, j)], &lc);
+		shot_eol(fd, &lc);
+	}
+	shot_flush(fd);
+}
+
+/* return a pipe to command zip, which writes to fd */
+static int shot_zip(int fd, char **zip, int *zpid)
+{
+	int pfd[2];
+	if (pipe(pfd) || (*zpid = fork()) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (!*zpid) {
+		dup2(pfd[0], 0);
+		dup2(fd, 1);
+		close(pfd[0]);
+		close(pfd[1]);
+		execvp(zip[0], zip);
+		_exit(1);
 	}
+	close(pfd[0]);
 	close(fd);
+	return pfd[1];
+}
+
+/*
+ * Write the screen, and its history if a is nonzero, to path.  A
+ * child process writes the copy of the terminal it gets from fork(),
+ * so that fbpad does not wait for it; it is reaped on SIGCHLD.
+ */
+void term_screenshot(const char *path, int a)
+{
+	char *zip[] = SCRZIP;
+	int pid = fork();
+	int fd, zpid = 0;
+	if (pid > 0 || (pid < 0 && zip[0]))
+		return;
+	if (!pid)
+		nice(10);
+	fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+	if (fd >= 0 && zip[0])
+		fd = shot_zip(fd, zip, &zpid);
+	if (fd >= 0) {
+		shot_write(fd, a);
+		close(fd);
+	}
+	if (zpid > 0)
+		waitpid(zpid, NULL, 0);
+	if (!pid)
+		_exit(0);
 }
 
 int term_colors(char *path)
@@ -636,6 +1158,8 @@ int term_colors(char *path)
 		}
 		fgets(t, sizeof(t), fp);
 	}
+	fclose(fp);
+	clr_load();
 	return 0;
 }
 
@@ -643,7 +1167,9 @@ int term_colors(char *path)
 
 static void empty_rows(int sr, int er)
 {
-	screen_reset(OFFSET(sr, 0), (er - sr) * pad_cols());
+	int i;
+	for (i = sr; i < er; i++)
+		screen_reset(i, 0, term->cols);
 }
 
 static void blank_rows(int sr, int er)
@@ -653,133 +1179,158 @@ static void blank_rows(int sr, int er)
 	draw_cursor(1);
 }
 
-#define HISTROW(pos)	(term->hist + ((term->hrow + NHIST - (pos)) % NHIST) * pad_cols())
-
 static void scrl_rows(int nr)
 {
 	int i;
-	for (i = 0; i < nr; i++) {
-		memcpy(HISTROW(0), screen + i * pad_cols(),
-				pad_cols() * sizeof(screen[0]));
-		term->hrow = (term->hrow + 1) % NHIST;
-	}
+	for (i = 0; i < nr; i++)
+		hist_push(term->screen + OFFSET(i, 0), term->clr + OFFSET(i, 0), term->cols);
 }
 
 void term_scrl(int scrl)
 {
 	int i, j;
-	int hpos = LIMIT(term->hpos + scrl, 0, NHIST);
+	int hpos = LIMIT(term->hpos + scrl, 0, term->hcnt);
 	term->hpos = hpos;
 	if (!hpos) {
 		lazy_flush();
 		return;
 	}
 	lazy_start();
-	memset(dirty, 1, pad_rows() * sizeof(*dirty));
+	memset(term->dirty, 1, pad_rows() * sizeof(*term->dirty));
+	drawn_reset(0, pad_rows());
 	for (i = 0; i < pad_rows(); i++) {
-		int off = (i - hpos) * pad_cols();
-		int *_scr = i < hpos ? HISTROW(hpos - i) : term->screen + off;
-		int *_clr = i < hpos ? NULL : term->clr + off;
 		for (j = 0; j < pad_cols(); j++) {
-			int c = _clr ? _clr[j] : CLR_MK(BG, FG);
-			pad_put(_scr[j], i, j, CLR_M(c) | clrmap(CLR_FG(c)), clrmap(CLR_BG(c)));
+			int c, ch;
+			if (i < hpos) {
+				ch = hist_cell(hpos - i, j, &c);
+			} else {
+				ch = term->screen[OFFSET(i - hpos, j)];
+				c = term->clr[OFFSET(i - hpos, j)];
+			}
+			pad_put(ch, i, j, CLR_M(c) | clrmap(CLR_FG(c)), clrmap(CLR_BG(c)));
 		}
 	}
 }
 
+/* move the pixels of rows sr to er by n rows; return zero if they need redrawing */
+static int scroll_pixels(int sr, int er, int n)
+{
+	int i;
+	if (visible && !term->lazy) {
+		_draw_scroll(n > 0 ? sr : sr - n, n > 0 ? er - n : er, n);
+		return 1;
+	}
+	if (!term->lazy || (term->pn && (term->psr != sr || term->per != er)))
+		return 0;
+	/* dirty rows move with their contents; lazy_flush() moves the pixels */
+	if (n > 0)
+		for (i = er - 1; i >= sr; i--)
+			term->dirty[i] = i - n >= sr ? term->dirty[i - n] : 1;
+	else
+		for (i = sr; i < er; i++)
+			term->dirty[i] = i - n < er ? term->dirty[i - n] : 1;
+	term->psr = sr;
+	term->per = er;
+	term->pn += n;
+	return 1;
+}
+
 static void scroll_screen(int sr, int nr, int n)
 {
+	int ar = MIN(sr, sr + n);
+	int er = MAX(sr + nr, sr + nr + n);
 	draw_cursor(0);
 	if (sr + n == 0)
 		scrl_rows(sr);
-	screen_move(OFFSET(sr + n, 0), OFFSET(sr, 0), nr * pad_cols());
+	if (!scroll_pixels(ar, er, n))
+		candraw(ar, er);
+	/* the rows scrolled over are reused for the new rows */
+	rmap_rotate(ar, er, n > 0 ? nr : -n);
 	if (n > 0)
-		empty_rows(sr, sr + n);
+		blank_rows(sr, sr + n);
 	else
-		empty_rows(sr + nr + n, sr + nr);
-	draw_rows(MIN(sr, sr + n), MAX(sr + nr, sr + nr + n));
-	draw_cursor(1);
+		blank_rows(sr + nr + n, sr + nr);
 }
 
 static void insert_lines(int n)
 {
-	int sr = MAX(top, row);
-	int nr = bot - row - n;
+	int sr = MAX(term->top, term->row);
+	int nr = term->bot - term->row - n;
 	if (nr > 0)
 		scroll_screen(sr, nr, n);
 }
 
 static void delete_lines(int n)
 {
-	int r = MAX(top, row);
+	int r = MAX(term->top, term->row);
 	int sr = r + n;
-	int nr = bot - r - n;
+	int nr = term->bot - r - n;
 	if (nr > 0)
 		scroll_screen(sr, nr, -n);
 }
 
 static int origin(void)
 {
-	return mode & MODE_ORIGIN;
+	return term->mode & MODE_ORIGIN;
 }
 
 static void move_cursor(int r, int c)
 {
 	int t, b;
 	draw_cursor(0);
-	t = origin() ? top : 0;
-	b = origin() ? bot : pad_rows();
-	row = LIMIT(r, t, b - 1);
-	col = LIMIT(c, 0, pad_cols() - 1);
+	t = origin() ? term->top : 0;
+	b = origin() ? term->bot : term->rows;
+	term->row = LIMIT(r, t, b - 1);
+	term->col = LIMIT(c, 0, term->cols - 1);
 	draw_cursor(1);
-	mode = BIT_SET(mode, MODE_WRAPREADY, 0);
+	term->mode = BIT_SET(term->mode, MODE_WRAPREADY, 0);
 }
 
 static void set_region(int t, int b)
 {
-	top = LIMIT(t - 1, 0, pad_rows() - 1);
-	bot = LIMIT(b ? b : pad_rows(), top + 1, pad_rows());
+	term->top = LIMIT(t - 1, 0, term->rows - 1);
+	term->bot = LIMIT(b ? b : term->rows, term->top + 1, term->rows);
 	if (origin())
-		move_cursor(top, 0);
+		move_cursor(term->top, 0);
 }
 
 static void setattr(int m)
 {
 	if (!m || (m / 10) == 3)
-		mode |= MODE_CLR8;
+		term->mode |= MODE_CLR8;
 	switch (m) {
 	case 0:
-		fg = FG;
-		bg = BG;
-		mode &= ~ATTR_ALL;
+		term->fg = FG;
+		term->bg = BG;
+		term->mode &= ~ATTR_ALL;
 		break;
 	case 1:
-		mode |= ATTR_BOLD;
+		term->mode |= ATTR_BOLD;
 		break;
 	case 3:
-		mode |= ATTR_ITALIC;
+		term->mode |= ATTR_ITALIC;
 		break;
 	case 7:
-		mode |= ATTR_REV;
+		term->mode |= ATTR_REV;
 		break;
 	case 22:
-		mode &= ~ATTR_BOLD;
+		term->mode &= ~ATTR_BOLD;
 		break;
 	case 23:
-		mode &= ~ATTR_ITALIC;
+		term->mode &= ~ATTR_ITALIC;
 		break;
 	case 27:
-		mode &= ~ATTR_REV;
+		term->mode &= ~ATTR_REV;
 		break;
 	default:
 		if ((m / 10) == 3)
-			fg = m > 37 ? FG : m - 30;
+			term->fg = m > 37 ? FG : m - 30;
 		if ((m / 10) == 4)
-			bg = m > 47 ? BG : m - 40;
+			term->bg = m > 47 ? BG : m - 40;
 		if ((m / 10) == 9)
-			fg = 8 + m - 90;
+			term->fg = 8 + m - 90;
 		if ((m / 10) == 10)
-			bg = 8 + m - 100;
+			term->bg = 8 + m - 100;
 	}
 }
 
@@ -787,69 +1338,97 @@ static void kill_chars(int sc, int ec)
 {
 	int i;
 	for (i = sc; i < ec; i++)
-		draw_char(0, row, i);
+		draw_char(0, term->row, i);
 	draw_cursor(1);
 }
 
 static void move_chars(int sc, int nc, int n)
 {
 	draw_cursor(0);
-	screen_move(OFFSET(row, sc + n), OFFSET(row, sc), nc);
+	screen_move(term->row, sc + n, sc, nc);
 	if (n > 0)
-		screen_reset(OFFSET(row, sc), n);
+		screen_reset(term->row, sc, n);
 	else
-		screen_reset(OFFSET(row, pad_cols() + n), -n);
-	draw_cols(row, MIN(sc, sc + n), pad_cols());
+		screen_reset(term->row, term->cols + n, -n);
+	draw_cols(term->row, MIN(sc, sc + n), term->cols);
 	draw_cursor(1);
 }
 
 static void delete_chars(int n)
 {
-	int sc = col + n;
-	int nc = pad_cols() - sc;
+	int sc = term->col + n;
+	int nc = term->cols - sc;
 	move_chars(sc, nc, -n);
 }
 
 static void insert_chars(int n)
 {
-	int nc = pad_cols() - col - n;
-	move_chars(col, nc, n);
+	int nc = term->cols - term->col - n;
+	move_chars(term->col, nc, n);
 }
 
 static void advance(int dr, int dc, int scrl)
 {
-	int r = row + dr;
-	int c = col + dc;
-	if (dr && r >= bot && scrl) {
-		int n = bot - r - 1;
-		int nr = (bot - top) + n;
+	int r = term->row + dr;
+	int c = term->col + dc;
+	if (dr && r >= term->bot && scrl) {
+		int n = term->bot - r - 1;
+		int nr = (term->bot - term->top) + n;
 		if (nr > 0)
-			scroll_screen(top + -n, nr, n);
+			scroll_screen(term->top + -n, nr, n);
 	}
-	if (dr && r < top && scrl) {
-		int n = top - r;
-		int nr = (bot - top) - n;
+	if (dr && r < term->top && scrl) {
+		int n = term->top - r;
+		int nr = (term->bot - term->top) - n;
 		if (nr > 0)
-			scroll_screen(top, nr, n);
+			scroll_screen(term->top, nr, n);
 	}
-	r = dr ? LIMIT(r, top, bot - 1) : r;
-	c = LIMIT(c, 0, pad_cols() - 1);
+	r = dr ? LIMIT(r, term->top, term->bot - 1) : r;
+	c = LIMIT(c, 0, term->cols - 1);
 	move_cursor(r, c);
 }
 
 static void insertchar(int c)
 {
-	if (mode & MODE_WRAPREADY)
-		advance(1, -col, 1);
-	if (mode & MODE_INSERT)
+	if (term->mode & MODE_WRAPREADY)
+		advance(1, -term->col, 1);
+	if (term->mode & MODE_INSERT)
 		insert_chars(1);
-	draw_char(c, row, col);
-	if (col == pad_cols() - 1)
-		mode = BIT_SET(mode, MODE_WRAPREADY, 1);
+	draw_char(c, term->row, term->col);
+	if (term->col == term->cols - 1)
+		term->mode = BIT_SET(term->mode, MODE_WRAPREADY, 1);
 	else
 		advance(0, 1, 1);
 }
 
+/* insert the run of printable ASCII characters starting at ptybuf[ptycur - 1] */
+static void insertascii(void)
+{
+	char *s = ptybuf + ptycur - 1;
+	int c = color();
+	int i, n, o;
+	if (term->mode & MODE_WRAPREADY)
+		advance(1, -term->col, 1);
+	n = MIN(term->cols - term->col, ptylen - ptycur + 1);
+	if (origin() && (term->row < term->top || term->row >= term->bot))	/* moving the cursor changes row */
+		n = 1;
+	for (i = 1; i < n; i++)
+		if (s[i] < 0x20 || s[i] >= 0x7f)
+			break;
+	n = i;
+	o = OFFSET(term->row, term->col);
+	for (i = 0; i < n; i++) {
+		term->screen[o + i] = (unsigned char) s[i];
+		term->clr[o + i] = c;
+	}
+	ptycur += n - 1;
+	draw_cols(term->row, term->col, term->col + n);
+	term->col += n - 1;
+	if (term->col == term->cols - 1)
+		term->mode = BIT_SET(term->mode, MODE_WRAPREADY, 1);
+	else
+		advance(0, 1, 1);
+}
 
 /* partial vt102 implementation */
 
@@ -889,14 +1468,15 @@ static int readutf8(int c)
 static void ctlseq(void)
 {
 	int c = readpty();
+	int w;
 	switch (c) {
 	case 0x09:	/* HT		horizontal tab to next tab stop */
-		advance(0, 8 - col % 8, 0);
+		advance(0, 8 - term->col % 8, 0);
 		break;
 	case 0x0a:	/* LF		line feed */
 	case 0x0b:	/* VT		line feed */
 	case 0x0c:	/* FF		line feed */
-		advance(1, (mode & MODE_AUTOCR) ? -col : 0, 1);
+		advance(1, (term->mode & MODE_AUTOCR) ? -term->col : 0, 1);
 		break;
 	case 0x08:	/* BS		backspace one column */
 		advance(0, -1, 0);
@@ -905,7 +1485,7 @@ static void ctlseq(void)
 		escseq();
 		break;
 	case 0x0d:	/* CR		carriage return */
-		advance(0, -col, 0);
+		advance(0, -term->col, 0);
 		break;
 	case 0x9b:	/* CSI		equivalent to ESC [ */
 		csiseq();
@@ -924,12 +1504,17 @@ static void ctlseq(void)
 		unknown("ctlseq", c);
 		break;
 	default:
+		if (c >= 0x20 && c < 0x7f && ~term->mode & MODE_INSERT) {
+			insertascii();
+			break;
+		}
 		c = readutf8(c);
-		if (isdw(c) && col + 1 == pad_cols() && ~mode & MODE_WRAPREADY)
+		w = c < 0x80 ? 1 : chwid(c);
+		if (w == 2 && term->col + 1 == term->cols && ~term->mode & MODE_WRAPREADY)
 			insertchar(0);
-		if (!iszw(c))
+		if (w)
 			insertchar(c);
-		if (isdw(c))
+		if (w == 2)
 			insertchar(c | DWCHAR);
 		break;
 	}
@@ -976,7 +1561,7 @@ static void escseq(void)
 		advance(1, 0, 1);
 		break;
 	case 'E':	/* NEL		newline */
-		advance(1, -col, 1);
+		advance(1, -term->col, 1);
 		break;
 	case 'c':	/* RIS		reset */
 		term_reset();
@@ -1079,7 +1664,7 @@ static void escseq_g3(void)
 
 static int absrow(int r)
 {
-	return origin() ? top + r : r;
+	return origin() ? term->top + r : r;
 }
 
 #define CSIP(c)			(((c) & 0xf0) == 0x30)
@@ -1121,12 +1706,12 @@ static void csiseq(void)
 	case 'J':	/* ED		erase display */
 		switch (args[0]) {
 		case 0:
-			kill_chars(col, pad_cols());
-			blank_rows(row + 1, pad_rows());
+			kill_chars(term->col, term->cols);
+			blank_rows(term->row + 1, term->rows);
 			break;
 		case 1:
-			kill_chars(0, col + 1);
-			blank_rows(0, row - 1);
+			kill_chars(0, term->col + 1);
+			blank_rows(0, term->row - 1);
 			break;
 		case 2:
 			term_blank();
@@ -1150,69 +1735,68 @@ static void csiseq(void)
 	case 'K':	/* EL		erase line */
 		switch (args[0]) {
 		case 0:
-			kill_chars(col, pad_cols());
+			kill_chars(term->col, term->cols);
 			break;
 		case 1:
-			kill_chars(0, col + 1);
+			kill_chars(0, term->col + 1);
 			break;
 		case 2:
-			kill_chars(0, pad_cols());
+			kill_chars(0, term->cols);
 			break;
 		}
 		break;
 	case 'L':	/* IL		insert blank lines */
-		if (row >= top && row < bot)
+		if (term->row >= term->top && term->row < term->bot)
 			insert_lines(MAX(1, args[0]));
 		break;
 	case 'M':	/* DL		delete lines */
-		if (row >= top && row < bot)
+		if (term->row >= term->top && term->row < term->bot)
 			delete_lines(MAX(1, args[0]));
 		break;
 	case 'S':	/* SU		scroll up */
-		i = MAX(1, args[0]);
-		scroll_screen(i, pad_rows() - i, -i);
+		i = LIMIT(args[0], 1, term->rows);	/* at most the whole screen */
+		scroll_screen(i, term->rows - i, -i);
 		break;
 	case 'T':	/* SD		scroll down */
-		i = MAX(1, args[0]);
-		scroll_screen(0, pad_rows() - i, i);
+		i = LIMIT(args[0], 1, term->rows);	/* at most the whole screen */
+		scroll_screen(0, term->rows - i, i);
 		break;
 	case 'd':	/* VPA		move to row (current column) */
-		move_cursor(absrow(MAX(1, args[0]) - 1), col);
+		move_cursor(absrow(MAX(1, args[0]) - 1), term->col);
 		break;
 	case 'm':	/* SGR		set graphic rendition */
 		if (!n)
 			setattr(0);
 		for (i = 0; i < n; i++) {
 			if (args[i] == 38 && args[i + 1] == 2) {
-				mode &= ~MODE_CLR8;
-				fg = (args[i + 2] << 16) |
+				term->mode &= ~MODE_CLR8;
+				term->fg = (args[i + 2] << 16) |
 					(args[i + 3] << 8) | args[i + 4];
 				i += 5;
 				continue;
 			}
 			if (args[i] == 38) {
-				mode &= ~MODE_CLR8;
-				fg = args[i + 2];
+				term->mode &= ~MODE_CLR8;
+				term->fg = args[i + 2];
 				i += 2;
 				continue;
 			}
 			if (args[i] == 48 && args[i + 1] == 2) {
-				bg = (args[i + 2] << 16) |
+				term->bg = (args[i + 2] << 16) |
 					(args[i + 3] << 8) | args[i + 4];
 				i += 5;
 				continue;
 			}
 			if (args[i] == 48) {
-				bg = args[i + 2];
+				term->bg = args[i + 2];
 				i += 2;
 				continue;
 			}
 			setattr(args[i]);
 		}
-		if (mode & MODE_CLR8 && mode & ATTR_BOLD && BRIGHTEN)
-			for (i = 0; i < 8; i++)
-				if (clr16[i] == fg)
-					fg = clr16[8 + i];
+		/* colours 8-15 of the palette are the bright variants of 0-7 */
+		if (term->mode & MODE_CLR8 && term->mode & ATTR_BOLD && BRIGHTEN && term->fg < 8)
+			term->fg += 8;
 		break;
 	case 'r':	/* DECSTBM	set scrolling region to (top, bottom) rows */
 		set_region(args[0], args[1]);
@@ -1231,19 +1815,19 @@ static void csiseq(void)
 		draw_cursor(1);
 		break;
 	case 'P':	/* DCH		delete characters on current line */
-		delete_chars(LIMIT(args[0], 1, pad_cols() - col));
+		delete_chars(LIMIT(args[0], 1, term->cols - term->col));
 		break;
 	case '@':	/* ICH		insert blank characters */
-		insert_chars(LIMIT(args[0], 1, pad_cols() - col));
+		insert_chars(LIMIT(args[0], 1, term->cols - term->col));
 		break;
 	case 'n':	/* DSR		device status report */
 		csiseq_dsr(args[0]);
 		break;
 	case 'G':	/* CHA		move cursor to column in current row */
-		advance(0, MAX(0, args[0] - 1) - col, 0);
+		advance(0, MAX(0, args[0] - 1) - term->col, 0);
 		break;
 	case 'X':	/* ECH		erase characters on current line */
-		kill_chars(col, MIN(col + MAX(1, args[0]), pad_cols()));
+		kill_chars(term->col, MIN(term->col + MAX(1, args[0]), term->cols));
 		break;
 	case '[':	/* IGN		ignored control sequence */
 	case 'E':	/* CNL		move cursor down and to column 1 */
@@ -1281,7 +1865,7 @@ static void csiseq_dsr(int c)
 		break;
 	case 0x06:
 		sprintf(status, "\x1b[%d;%dR",
-			 (origin() ? row - top : row) + 1, col + 1);
+			 (origin() ? term->row - term->top : term->row) + 1, term->col + 1);
 		term_sendstr(status);
 		break;
 	default:
@@ -1295,19 +1879,19 @@ static void modeseq(int c, int set)
 {
 	switch (c) {
 	case 0x87:	/* DECAWM	Auto Wrap */
-		mode = BIT_SET(mode, MODE_WRAP, set);
+		term->mode = BIT_SET(term->mode, MODE_WRAP, set);
 		break;
 	case 0x99:	/* DECTCEM	Cursor on (set); Cursor off (reset) */
-		mode = BIT_SET(mode, MODE_CURSOR, set);
+		term->mode = BIT_SET(term->mode, MODE_CURSOR, set);
 		break;
 	case 0x86:	/* DECOM	Sets relative coordinates (set); Sets absolute coordinates (reset) */
-		mode = BIT_SET(mode, MODE_ORIGIN, set);
+		term->mode = BIT_SET(term->mode, MODE_ORIGIN, set);
 		break;
 	case 0x14:	/* LNM		Line Feed / New Line Mode */
-		mode = BIT_SET(mode, MODE_AUTOCR, set);
+		term->mode = BIT_SET(term->mode, MODE_AUTOCR, set);
 		break;
 	case 0x04:	/* IRM		insertion/replacement mode (always reset) */
-		mode = BIT_SET(mode, MODE_INSERT, set);
+		term->mode = BIT_SET(term->mode, MODE_INSERT, set);
 		break;
 	case 0x00:	/* IGN		error (ignored) */
 	case 0x01:	/* GATM		guarded-area transfer mode (ignored) */